@@ -2,9 +2,386 @@
 
 #include "Structures/GMM.h"
 
+#include "Algo/Partition.h"
+#include "Async/ParallelFor.h"
+
 // (2 pi) ^ 3
 #define TWOPI_P_3 248.0502134424f
 
+namespace GMM
+{
+	// Uniform grid over a set of positions, about one position per cell unless a cell size is given
+	struct FGrid
+	{
+		FGrid(const TArray<FVector>& Positions, double MinCellSize = 0.0)
+			: Positions(Positions)
+		{
+			FBox Bounds(Positions);
+			const FVector Extent = Bounds.GetSize();
+			CellSize = FMath::Max(Extent.GetMax() / FMath::Max(1.0, FMath::Pow(double(Positions.Num()), 1.0 / 3.0)), double(KINDA_SMALL_NUMBER));
+			if (MinCellSize > 0.0)
+			{
+				// Cells only ever grow so neighbours stay within one cell, but not past a few cells per position
+				CellSize = FMath::Max(MinCellSize, CellSize * 0.5);
+			}
+			Min = Bounds.Min;
+			Dims = FIntVector(
+				FMath::Min(FMath::FloorToInt(Extent.X / CellSize) + 1, 1024),
+				FMath::Min(FMath::FloorToInt(Extent.Y / CellSize) + 1, 1024),
+				FMath::Min(FMath::FloorToInt(Extent.Z / CellSize) + 1, 1024));
+
+			// Counting sort by cell
+			CellStart.SetNumZeroed(Dims.X * Dims.Y * Dims.Z + 1);
+			TArray<int32> Cells;
+			Cells.SetNumUninitialized(Positions.Num());
+			for (int32 Index = 0; Index < Positions.Num(); Index++)
+			{
+				Cells[Index] = GetIndex(GetCell(Positions[Index]));
+				CellStart[Cells[Index] + 1]++;
+			}
+			for (int32 Cell = 1; Cell < CellStart.Num(); Cell++)
+			{
+				CellStart[Cell] += CellStart[Cell - 1];
+			}
+
+			TArray<int32> Fill = CellStart;
+			Items.SetNumUninitialized(Positions.Num());
+			for (int32 Index = 0; Index < Positions.Num(); Index++)
+			{
+				Items[Fill[Cells[Index]]++] = Index;
+			}
+		}
+
+		FIntVector GetCell(const FVector& Point) const
+		{
+			const FVector Coord = (Point - Min) / CellSize;
+			return FIntVector(
+				FMath::Clamp(FMath::FloorToInt(Coord.X), 0, Dims.X - 1),
+				FMath::Clamp(FMath::FloorToInt(Coord.Y), 0, Dims.Y - 1),
+				FMath::Clamp(FMath::FloorToInt(Coord.Z), 0, Dims.Z - 1));
+		}
+
+		int32 GetIndex(const FIntVector& Cell) const
+		{
+			return (Cell.Z * Dims.Y + Cell.Y) * Dims.X + Cell.X;
+		}
+
+		// Index of the closest position other than an excluded one, searched in growing shells of cells around the point
+		int32 FindNearest(const FVector& Point, int32 Exclude = INDEX_NONE) const
+		{
+			const FIntVector Center = GetCell(Point);
+			int32 Best = INDEX_NONE;
+			double BestDistance = TNumericLimits<double>::Max();
+
+			const int32 MaxRing = FMath::Max3(Dims.X, Dims.Y, Dims.Z);
+			for (int32 Ring = 0; Ring < MaxRing; Ring++)
+			{
+				for (int32 Z = FMath::Max(Center.Z - Ring, 0); Z <= FMath::Min(Center.Z + Ring, Dims.Z - 1); Z++)
+				{
+					for (int32 Y = FMath::Max(Center.Y - Ring, 0); Y <= FMath::Min(Center.Y + Ring, Dims.Y - 1); Y++)
+					{
+						// Inside the shell only the two ends along X are new
+						const bool bInner = Ring > 0 && FMath::Abs(Z - Center.Z) < Ring && FMath::Abs(Y - Center.Y) < Ring;
+						const int32 Step = bInner ? Ring * 2 : 1;
+						for (int32 X = Center.X - Ring; X <= Center.X + Ring; X += Step)
+						{
+							if (X < 0 || X >= Dims.X)
+							{
+								continue;
+							}
+
+							const int32 Cell = GetIndex(FIntVector(X, Y, Z));
+							for (int32 Item = CellStart[Cell]; Item < CellStart[Cell + 1]; Item++)
+							{
+								const double Distance = FVector::DistSquared(Positions[Items[Item]], Point);
+								if (Distance < BestDistance && Items[Item] != Exclude)
+								{
+									BestDistance = Distance;
+									Best = Items[Item];
+								}
+							}
+						}
+					}
+				}
+
+				// Positions in further shells are at least this far away
+				if (Best != INDEX_NONE && BestDistance <= FMath::Square(Ring * CellSize))
+				{
+					break;
+				}
+			}
+			return Best;
+		}
+
+		// Calls for every position in the cells around a point, includes everything within one cell size
+		template<typename FuncType>
+		void ForEachNear(const FVector& Point, FuncType&& Func) const
+		{
+			const FIntVector Center = GetCell(Point);
+			for (int32 Z = FMath::Max(Center.Z - 1, 0); Z <= FMath::Min(Center.Z + 1, Dims.Z - 1); Z++)
+			{
+				for (int32 Y = FMath::Max(Center.Y - 1, 0); Y <= FMath::Min(Center.Y + 1, Dims.Y - 1); Y++)
+				{
+					// Cells along X are contiguous
+					const int32 First = GetIndex(FIntVector(FMath::Max(Center.X - 1, 0), Y, Z));
+					const int32 Last = GetIndex(FIntVector(FMath::Min(Center.X + 1, Dims.X - 1), Y, Z));
+					for (int32 Item = CellStart[First]; Item < CellStart[Last + 1]; Item++)
+					{
+						Func(Items[Item]);
+					}
+				}
+			}
+		}
+
+		const TArray<FVector>& Positions;
+		FVector Min;
+		double CellSize;
+		FIntVector Dims;
+
+		// Positions sorted by cell, cell I holds CellStart[I] up to CellStart[I + 1]
+		TArray<int32> CellStart;
+		TArray<int32> Items;
+	};
+
+	// Node of a point kd-tree, children are stored next to each other
+	struct FTreeNode
+	{
+		// Bounds of the points below
+		FVector Min;
+		FVector Max;
+
+		// Sums over the points below, every point weighted one
+		FGMMStats Stats;
+
+		// Range of a leaf in the padded points
+		int32 First;
+		int32 Num;
+
+		// First child, INDEX_NONE for leaves
+		int32 Children;
+	};
+
+	// Points split at the middle of their longest axis, leaves start at multiples of four for batched evaluation
+	struct FTree
+	{
+		// Max points evaluated at once, a multiple of four
+		static constexpr int32 LeafSize = 64;
+
+		FTree(const TArray<FVector>& Points)
+			: Batch(Order(Points, Nodes))
+		{
+		}
+
+		// Padded points in leaf order, builds the nodes along the way
+		static TArray<FVector> Order(const TArray<FVector>& Input, TArray<FTreeNode>& Nodes)
+		{
+			// Points are partitioned in place, which keeps every pass over them linear in memory
+			TArray<FVector> Sorted = Input;
+			TArray<FVector> Ordered;
+			Ordered.Reserve(Input.Num() + Input.Num() / 8);
+			Nodes.AddDefaulted();
+			Build(Nodes, 0, Sorted.GetData(), Input.Num(), Ordered);
+			return Ordered;
+		}
+
+		static void Build(TArray<FTreeNode>& Nodes, int32 Index, FVector* Points, int32 Num, TArray<FVector>& Ordered)
+		{
+			FVector Min = Points[0], Max = Min;
+			for (int32 Item = 1; Item < Num; Item++)
+			{
+				Min = Min.ComponentMin(Points[Item]);
+				Max = Max.ComponentMax(Points[Item]);
+			}
+			Nodes[Index].Min = Min;
+			Nodes[Index].Max = Max;
+			Nodes[Index].Stats = FGMMStats((Min + Max) * 0.5);
+			Nodes[Index].Children = INDEX_NONE;
+
+			int32 Split = 0;
+			if (Num > LeafSize)
+			{
+				const FVector Size = Max - Min;
+				const int32 Axis = Size.X >= Size.Y ? (Size.X >= Size.Z ? 0 : 2) : (Size.Y >= Size.Z ? 1 : 2);
+				const double Middle = (Min[Axis] + Max[Axis]) * 0.5;
+				Split = Algo::Partition(Points, Num, [Axis, Middle](const FVector& Point) { return Point[Axis] < Middle; });
+			}
+
+			// Identical points end up in one leaf, however many there are
+			if (Split <= 0 || Split >= Num)
+			{
+				FTreeNode& Node = Nodes[Index];
+				Node.First = Ordered.Num();
+				Node.Num = Num;
+				for (int32 Item = 0; Item < Num; Item++)
+				{
+					Ordered.Emplace(Points[Item]);
+					Node.Stats.Add(1.0, Points[Item]);
+				}
+				while (Ordered.Num() % 4 != 0)
+				{
+					Ordered.Emplace(Ordered.Last());
+				}
+				return;
+			}
+
+			// Nodes may be invalidated from here on
+			const int32 Children = Nodes.AddDefaulted(2);
+			Nodes[Index].Children = Children;
+			Build(Nodes, Children, Points, Split, Ordered);
+			Build(Nodes, Children + 1, Points + Split, Num - Split, Ordered);
+
+			FGMMStats Stats = Nodes[Children].Stats;
+			Stats += Nodes[Children + 1].Stats;
+			Nodes[Index].Stats += Stats;
+		}
+
+		// Sums per distribution for one task
+		struct FVisit
+		{
+			const TArray<FGMMFactor>& Factors;
+			FGMMStats* Stats;
+			float Cutoff;
+			float Spread;
+			float* Rs;
+		};
+
+		void Visit(const FVisit& Context, int32 Index, const TArray<int32, TInlineAllocator<64>>& Live) const
+		{
+			const FTreeNode& Node = Nodes[Index];
+
+			TArray<int32, TInlineAllocator<64>> Open;
+			for (int32 Di : Live)
+			{
+				const FGMMFactor& Factor = Context.Factors[Di];
+				float Min, Max;
+				Factor.Distance(Node.Min, Node.Max, Min, Max);
+
+				// Density is below tolerance of the peak everywhere
+				if (Min >= Context.Cutoff)
+				{
+					continue;
+				}
+
+				// Density is about the same everywhere, take the sums of the node
+				if (Max - Min <= Context.Spread)
+				{
+					FGMMStats Stats = Node.Stats;
+					Stats.Scale(FMath::Exp(Factor.LogScale - 0.25f * (Min + Max)));
+					Context.Stats[Di] += Stats;
+					continue;
+				}
+				Open.Emplace(Di);
+			}
+
+			if (Open.Num() == 0)
+			{
+				return;
+			}
+
+			if (Node.Children == INDEX_NONE)
+			{
+				// Leaves of identical points can be bigger than the scratch buffer, chunks still start at multiples of four
+				for (int32 First = Node.First; First < Node.First + Node.Num; First += LeafSize)
+				{
+					const int32 Num = FMath::Min(LeafSize, Node.First + Node.Num - First);
+					for (int32 Di : Open)
+					{
+						Context.Factors[Di].Pdf(Batch, First, Num, Context.Rs);
+						Context.Stats[Di].Add(Batch, First, Num, Context.Rs);
+					}
+				}
+				return;
+			}
+
+			Visit(Context, Node.Children, Open);
+			Visit(Context, Node.Children + 1, Open);
+		}
+
+		// Sums per distribution into the first Factors.Num() entries of Stats
+		void EStep(const TArray<FGMMFactor>& Factors, float Tolerance, TArray<FGMMStats>& Stats, bool bForceSingleThread) const
+		{
+			const int32 DNum = Factors.Num();
+
+			// Subtrees to split over tasks, a few per worker
+			const int32 Workers = bForceSingleThread ? 1 : FPlatformMisc::NumberOfWorkerThreadsToSpawn() + 1;
+			TArray<int32> Frontier = { 0 };
+			while (Frontier.Num() < Workers * 4)
+			{
+				TArray<int32> Next;
+				for (int32 Index : Frontier)
+				{
+					const int32 Children = Nodes[Index].Children;
+					if (Children == INDEX_NONE)
+					{
+						Next.Emplace(Index);
+					}
+					else
+					{
+						Next.Emplace(Children);
+						Next.Emplace(Children + 1);
+					}
+				}
+
+				if (Next.Num() == Frontier.Num())
+				{
+					break;
+				}
+				Frontier = MoveTemp(Next);
+			}
+
+			const int32 TaskNum = FMath::Min(Workers, Frontier.Num());
+			Stats.Reset();
+			Stats.Reserve(TaskNum * DNum);
+			for (int32 Task = 0; Task < TaskNum; Task++)
+			{
+				for (const FGMMFactor& Factor : Factors)
+				{
+					Stats.Emplace(FVector(Factor.MuX, Factor.MuY, Factor.MuZ));
+				}
+			}
+
+			// Degenerate distributions have no density anywhere
+			TArray<int32, TInlineAllocator<64>> Live;
+			for (int32 Di = 0; Di < DNum; Di++)
+			{
+				if (!Factors[Di].bDegenerate)
+				{
+					Live.Emplace(Di);
+				}
+			}
+
+			// Squared mahalanobis distance past which the density drops below tolerance of the peak,
+			// and spread within which the density at the middle is off by at most tolerance
+			const float Cutoff = -2.0f * FMath::Loge(Tolerance);
+			const float Spread = 4.0f * FMath::Loge(1.0f + Tolerance);
+
+			ParallelFor(TaskNum, [&](int32 Task)
+			{
+				float Rs[LeafSize];
+				const FVisit Context = { Factors, &Stats[Task * DNum], Cutoff, Spread, Rs };
+
+				const int32 End = Frontier.Num() * (Task + 1) / TaskNum;
+				for (int32 Fi = Frontier.Num() * Task / TaskNum; Fi < End; Fi++)
+				{
+					Visit(Context, Frontier[Fi], Live);
+				}
+			}, bForceSingleThread);
+
+			// Reduce into the first task
+			for (int32 Task = 1; Task < TaskNum; Task++)
+			{
+				for (int32 Di = 0; Di < DNum; Di++)
+				{
+					Stats[Di] += Stats[Task * DNum + Di];
+				}
+			}
+		}
+
+		TArray<FTreeNode> Nodes;
+		FGMMPoints Batch;
+	};
+}
+
 FGMMDistribution::FGMMDistribution()
 : Mu(FVector::ZeroVector), Pi(1.0f)
 {
@@ -37,66 +414,424 @@ FGMMDistribution::FGMMDistribution(const TArray<FVector>& Samples)
 
 float FGMMDistribution::Pdf(const FVector& X) const
 {
-	const FVector Delta = X - Mu;
-	const float Exp = FMath::Exp(-0.5f * (Delta | Cov.CholeskyInvert(Delta)));
-	const float Det = TWOPI_P_3 * Cov.Det();
+	return FGMMFactor(*this, Pi).Pdf(X);
+}
+
+FGMMPoints::FGMMPoints(const TArray<FVector>& Points)
+	: Num(Points.Num())
+{
+	const int32 Padded = Align(Num, 4);
+	X.SetNumZeroed(Padded);
+	Y.SetNumZeroed(Padded);
+	Z.SetNumZeroed(Padded);
+	for (int32 Index = 0; Index < Num; Index++)
+	{
+		X[Index] = Points[Index].X;
+		Y[Index] = Points[Index].Y;
+		Z[Index] = Points[Index].Z;
+	}
+}
+
+FGMMFactor::FGMMFactor(const FGMMDistribution& Distribution, float Weight)
+	: MuX(Distribution.Mu.X), MuY(Distribution.Mu.Y), MuZ(Distribution.Mu.Z),
+	LXY(0.0f), LXZ(0.0f), LYZ(0.0f), InvLXX(1.0f), InvLYY(1.0f), InvLZZ(1.0f),
+	LogScale(0.0f), bDegenerate(false)
+{
+	const FMatrix3x3& Cov = Distribution.Cov;
+	const double Det = TWOPI_P_3 * Cov.Det();
 	if (Det < SMALL_NUMBER)
+	{
+		bDegenerate = true;
+		return;
+	}
+	LogScale = FMath::Loge(Weight) - FMath::Loge(Det);
+
+	// Same decomposition as FMatrix3x3::CholeskyInvert, keep identity on failure
+	const double lXX = FMath::Sqrt(Cov.X.X);
+	if (lXX < SMALL_NUMBER) return;
+	const double lXY = Cov.X.Y / lXX;
+	const double lXZ = Cov.X.Z / lXX;
+
+	const double lYY_ = Cov.Y.Y - lXY * lXY;
+	if (lYY_ < 0.0) return;
+	const double lYY = FMath::Sqrt(lYY_);
+	if (lYY < SMALL_NUMBER) return;
+	const double lYZ = (Cov.Y.Z - lXY * lXZ) / lYY;
+
+	const double lZZ_ = Cov.Z.Z - lXZ * lXZ - lYZ * lYZ;
+	if (lZZ_ < 0.0) return;
+	const double lZZ = FMath::Sqrt(lZZ_);
+	if (lZZ < SMALL_NUMBER) return;
+
+	LXY = lXY;
+	LXZ = lXZ;
+	LYZ = lYZ;
+	InvLXX = 1.0 / lXX;
+	InvLYY = 1.0 / lYY;
+	InvLZZ = 1.0 / lZZ;
+}
+
+float FGMMFactor::Pdf(const FVector& X) const
+{
+	if (bDegenerate)
 	{
 		return 0.0f;
 	}
-	return (Pi * Exp) / Det;
+	return FMath::Exp(LogScale - 0.5f * Distance(X));
+}
+
+float FGMMFactor::Distance(const FVector& X) const
+{
+	// Forward substitution, the squared length is the mahalanobis distance
+	const float BX = (X.X - MuX) * InvLXX;
+	const float BY = (X.Y - MuY - LXY * BX) * InvLYY;
+	const float BZ = (X.Z - MuZ - LXZ * BX - LYZ * BY) * InvLZZ;
+	return BX * BX + BY * BY + BZ * BZ;
+}
+
+void FGMMFactor::Distance(const FVector& Min, const FVector& Max, float& OutMin, float& OutMax) const
+{
+	// Forward substitution on intervals, the result holds every point of the box
+	const float BX0 = (Min.X - MuX) * InvLXX;
+	const float BX1 = (Max.X - MuX) * InvLXX;
+
+	auto Scale = [](float Factor, float Lo, float Hi, float& OutLo, float& OutHi)
+	{
+		OutLo = Factor >= 0.0f ? Factor * Lo : Factor * Hi;
+		OutHi = Factor >= 0.0f ? Factor * Hi : Factor * Lo;
+	};
+
+	float XY0, XY1;
+	Scale(LXY, BX0, BX1, XY0, XY1);
+	const float BY0 = (Min.Y - MuY - XY1) * InvLYY;
+	const float BY1 = (Max.Y - MuY - XY0) * InvLYY;
+
+	float XZ0, XZ1, YZ0, YZ1;
+	Scale(LXZ, BX0, BX1, XZ0, XZ1);
+	Scale(LYZ, BY0, BY1, YZ0, YZ1);
+	const float BZ0 = (Min.Z - MuZ - XZ1 - YZ1) * InvLZZ;
+	const float BZ1 = (Max.Z - MuZ - XZ0 - YZ0) * InvLZZ;
+
+	auto Square = [](float Lo, float Hi, float& OutLo, float& OutHi)
+	{
+		OutLo = Lo > 0.0f ? Lo * Lo : (Hi < 0.0f ? Hi * Hi : 0.0f);
+		OutHi = FMath::Max(Lo * Lo, Hi * Hi);
+	};
+
+	float X0, X1, Y0, Y1, Z0, Z1;
+	Square(BX0, BX1, X0, X1);
+	Square(BY0, BY1, Y0, Y1);
+	Square(BZ0, BZ1, Z0, Z1);
+	OutMin = X0 + Y0 + Z0;
+	OutMax = X1 + Y1 + Z1;
+}
+
+void FGMMFactor::Pdf(const FGMMPoints& Points, int32 First, int32 Num, float* Out) const
+{
+	check(First % 4 == 0);
+	const int32 Padded = Align(Num, 4);
+	if (bDegenerate)
+	{
+		FMemory::Memzero(Out, Padded * sizeof(float));
+		return;
+	}
+
+	const VectorRegister4Float VMuX = VectorSetFloat1(MuX);
+	const VectorRegister4Float VMuY = VectorSetFloat1(MuY);
+	const VectorRegister4Float VMuZ = VectorSetFloat1(MuZ);
+	const VectorRegister4Float VLXY = VectorSetFloat1(LXY);
+	const VectorRegister4Float VLXZ = VectorSetFloat1(LXZ);
+	const VectorRegister4Float VLYZ = VectorSetFloat1(LYZ);
+	const VectorRegister4Float VInvLXX = VectorSetFloat1(InvLXX);
+	const VectorRegister4Float VInvLYY = VectorSetFloat1(InvLYY);
+	const VectorRegister4Float VInvLZZ = VectorSetFloat1(InvLZZ);
+	const VectorRegister4Float VLogScale = VectorSetFloat1(LogScale);
+	const VectorRegister4Float VHalf = VectorSetFloat1(-0.5f);
+
+	const float* X = Points.X.GetData() + First;
+	const float* Y = Points.Y.GetData() + First;
+	const float* Z = Points.Z.GetData() + First;
+	for (int32 Index = 0; Index < Padded; Index += 4)
+	{
+		// Same as the scalar version, four points at a time
+		const VectorRegister4Float BX = VectorMultiply(VectorSubtract(VectorLoad(X + Index), VMuX), VInvLXX);
+		const VectorRegister4Float DY = VectorSubtract(VectorLoad(Y + Index), VMuY);
+		const VectorRegister4Float BY = VectorMultiply(VectorNegateMultiplyAdd(VLXY, BX, DY), VInvLYY);
+		const VectorRegister4Float DZ = VectorSubtract(VectorLoad(Z + Index), VMuZ);
+		const VectorRegister4Float BZ = VectorMultiply(VectorNegateMultiplyAdd(VLYZ, BY, VectorNegateMultiplyAdd(VLXZ, BX, DZ)), VInvLZZ);
+
+		const VectorRegister4Float Distance = VectorMultiplyAdd(BX, BX, VectorMultiplyAdd(BY, BY, VectorMultiply(BZ, BZ)));
+		VectorStore(VectorExp(VectorMultiplyAdd(Distance, VHalf, VLogScale)), Out + Index);
+	}
+}
+
+FGMMStats::FGMMStats()
+	: FGMMStats(FVector::ZeroVector)
+{
+}
+
+FGMMStats::FGMMStats(const FVector& Reference)
+	: Reference(Reference), Weight(0.0), SumX(0.0), SumY(0.0), SumZ(0.0), XX(0.0), XY(0.0), XZ(0.0), YY(0.0), YZ(0.0), ZZ(0.0)
+{
+}
+
+void FGMMStats::Add(double W, const FVector& Point)
+{
+	const FVector Delta = Point - Reference;
+	Weight += W;
+	SumX += W * Delta.X;
+	SumY += W * Delta.Y;
+	SumZ += W * Delta.Z;
+	XX += W * Delta.X * Delta.X;
+	XY += W * Delta.X * Delta.Y;
+	XZ += W * Delta.X * Delta.Z;
+	YY += W * Delta.Y * Delta.Y;
+	YZ += W * Delta.Y * Delta.Z;
+	ZZ += W * Delta.Z * Delta.Z;
+}
+
+void FGMMStats::Add(double W, const FVector& Mu, const FMatrix3x3& Cov)
+{
+	// Outer products around the reference are the covariance plus the shift of the mean
+	Add(W, Mu);
+	XX += W * Cov.X.X;
+	XY += W * Cov.X.Y;
+	XZ += W * Cov.X.Z;
+	YY += W * Cov.Y.Y;
+	YZ += W * Cov.Y.Z;
+	ZZ += W * Cov.Z.Z;
+}
+
+void FGMMStats::Add(const FGMMPoints& Points, int32 First, int32 Num, const float* Weights)
+{
+	check(First % 4 == 0);
+
+	const VectorRegister4Float RefX = VectorSetFloat1(Reference.X);
+	const VectorRegister4Float RefY = VectorSetFloat1(Reference.Y);
+	const VectorRegister4Float RefZ = VectorSetFloat1(Reference.Z);
+
+	// Four lanes in float, the range is expected to be short enough for that
+	VectorRegister4Float W = VectorZeroFloat(), SX = W, SY = W, SZ = W;
+	VectorRegister4Float VXX = W, VXY = W, VXZ = W, VYY = W, VYZ = W, VZZ = W;
+
+	const float* X = Points.X.GetData() + First;
+	const float* Y = Points.Y.GetData() + First;
+	const float* Z = Points.Z.GetData() + First;
+	const int32 Whole = Num & ~3;
+	for (int32 Index = 0; Index < Align(Num, 4); Index += 4)
+	{
+		VectorRegister4Float R = VectorLoad(Weights + Index);
+		if (Index == Whole)
+		{
+			// Padding past the end doesn't count
+			alignas(16) float Tail[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			FMemory::Memcpy(Tail, Weights + Index, (Num - Whole) * sizeof(float));
+			R = VectorLoadAligned(Tail);
+		}
+
+		const VectorRegister4Float DX = VectorSubtract(VectorLoad(X + Index), RefX);
+		const VectorRegister4Float DY = VectorSubtract(VectorLoad(Y + Index), RefY);
+		const VectorRegister4Float DZ = VectorSubtract(VectorLoad(Z + Index), RefZ);
+		const VectorRegister4Float RX = VectorMultiply(R, DX);
+		const VectorRegister4Float RY = VectorMultiply(R, DY);
+		const VectorRegister4Float RZ = VectorMultiply(R, DZ);
+
+		W = VectorAdd(W, R);
+		SX = VectorAdd(SX, RX);
+		SY = VectorAdd(SY, RY);
+		SZ = VectorAdd(SZ, RZ);
+		VXX = VectorMultiplyAdd(RX, DX, VXX);
+		VXY = VectorMultiplyAdd(RX, DY, VXY);
+		VXZ = VectorMultiplyAdd(RX, DZ, VXZ);
+		VYY = VectorMultiplyAdd(RY, DY, VYY);
+		VYZ = VectorMultiplyAdd(RY, DZ, VYZ);
+		VZZ = VectorMultiplyAdd(RZ, DZ, VZZ);
+	}
+
+	auto Sum = [](const VectorRegister4Float& Lanes)
+	{
+		alignas(16) float Out[4];
+		VectorStoreAligned(Lanes, Out);
+		return double(Out[0]) + Out[1] + Out[2] + Out[3];
+	};
+
+	Weight += Sum(W);
+	SumX += Sum(SX);
+	SumY += Sum(SY);
+	SumZ += Sum(SZ);
+	XX += Sum(VXX);
+	XY += Sum(VXY);
+	XZ += Sum(VXZ);
+	YY += Sum(VYY);
+	YZ += Sum(VYZ);
+	ZZ += Sum(VZZ);
+}
+
+void FGMMStats::Scale(double Factor)
+{
+	Weight *= Factor;
+	SumX *= Factor;
+	SumY *= Factor;
+	SumZ *= Factor;
+	XX *= Factor;
+	XY *= Factor;
+	XZ *= Factor;
+	YY *= Factor;
+	YZ *= Factor;
+	ZZ *= Factor;
+}
+
+void FGMMStats::Rebase(const FVector& NewReference)
+{
+	// Every offset grows by the same amount, outer products pick up the cross terms
+	const FVector Offset = Reference - NewReference;
+	XX += 2.0 * SumX * Offset.X + Weight * Offset.X * Offset.X;
+	XY += SumX * Offset.Y + SumY * Offset.X + Weight * Offset.X * Offset.Y;
+	XZ += SumX * Offset.Z + SumZ * Offset.X + Weight * Offset.X * Offset.Z;
+	YY += 2.0 * SumY * Offset.Y + Weight * Offset.Y * Offset.Y;
+	YZ += SumY * Offset.Z + SumZ * Offset.Y + Weight * Offset.Y * Offset.Z;
+	ZZ += 2.0 * SumZ * Offset.Z + Weight * Offset.Z * Offset.Z;
+	SumX += Weight * Offset.X;
+	SumY += Weight * Offset.Y;
+	SumZ += Weight * Offset.Z;
+	Reference = NewReference;
+}
+
+FGMMStats& FGMMStats::operator+=(const FGMMStats& Other)
+{
+	if (Other.Reference != Reference)
+	{
+		FGMMStats Moved = Other;
+		Moved.Rebase(Reference);
+		return *this += Moved;
+	}
+
+	Weight += Other.Weight;
+	SumX += Other.SumX;
+	SumY += Other.SumY;
+	SumZ += Other.SumZ;
+	XX += Other.XX;
+	XY += Other.XY;
+	XZ += Other.XZ;
+	YY += Other.YY;
+	YZ += Other.YZ;
+	ZZ += Other.ZZ;
+	return *this;
+}
+
+FVector FGMMStats::GetMu() const
+{
+	return Reference + FVector(SumX, SumY, SumZ) / Weight;
+}
+
+FMatrix3x3 FGMMStats::GetCov() const
+{
+	const FVector Shift = FVector(SumX, SumY, SumZ) / Weight;
+	const FMatrix3x3 Square(FVector(XX, XY, XZ), FVector(XY, YY, YZ), FVector(XZ, YZ, ZZ));
+	return Square * (1.0 / Weight) - FMatrix3x3(Shift, Shift);
 }
 
 FGMM::FGMM()
+	: Tolerance(0.0f), bOnline(false), Forgetting(1.0f), MaxDistributions(0), SpawnDistance(3.0f), TreeCrc(0), TreeNum(0)
 {
 
 }
 
-float FGMM::Step()
+// Points evaluated per distribution at once, small enough to stay in cache
+#define GMM_BATCH_SIZE 1024
+
+void FGMM::EStep(const TArray<FGMMFactor>& Factors, TArray<FGMMStats>& Stats, bool bForceSingleThread) const
 {
-	const int32 DNum = Distributions.Num();
+	const int32 DNum = Factors.Num();
 	const int32 PNum = Points.Num();
-	if (PNum == 0) return 0.0f;
+	const FGMMPoints Batch(Points);
 
-	TArray<TArray<float>> Rs;
+	// Every task sums its own contiguous range of batches, relative to the current means
+	const int32 BatchNum = FMath::DivideAndRoundUp(PNum, GMM_BATCH_SIZE);
+	const int32 TaskNum = bForceSingleThread ? 1 : FMath::Clamp(FPlatformMisc::NumberOfWorkerThreadsToSpawn() + 1, 1, BatchNum);
+	Stats.Reset();
+	Stats.Reserve(TaskNum * DNum);
+	for (int32 Task = 0; Task < TaskNum; Task++)
+	{
+		for (const FGMMFactor& Factor : Factors)
+		{
+			Stats.Emplace(FVector(Factor.MuX, Factor.MuY, Factor.MuZ));
+		}
+	}
 
 	// EStep
-	Rs.SetNumZeroed(DNum);
-	for (int32 Di = 0; Di < DNum; Di++)
+	ParallelFor(TaskNum, [&](int32 Task)
 	{
-		const FGMMDistribution& Distribution = Distributions[Di];
+		FGMMStats* TaskStats = &Stats[Task * DNum];
+		float Rs[GMM_BATCH_SIZE];
 
-		// Compute pdfs
-		float PSum = 0.0f;
-		Rs[Di].SetNumUninitialized(PNum);
-		for (int32 Pi = 0; Pi < PNum; Pi++)
+		const int32 BatchEnd = BatchNum * (Task + 1) / TaskNum;
+		for (int32 Bi = BatchNum * Task / TaskNum; Bi < BatchEnd; Bi++)
 		{
-			Rs[Di][Pi] = Distribution.Pdf(Points[Pi]) * Distribution.Pi;
-			PSum += Rs[Di][Pi];
+			const int32 First = Bi * GMM_BATCH_SIZE;
+			const int32 Num = FMath::Min(GMM_BATCH_SIZE, PNum - First);
+			for (int32 Di = 0; Di < DNum; Di++)
+			{
+				// Normalisation per distribution cancels out in mean and cov, so raw pdfs are summed
+				const FGMMFactor& Factor = Factors[Di];
+				Factor.Pdf(Batch, First, Num, Rs);
+				TaskStats[Di].Add(Batch, First, Num, Rs);
+			}
 		}
+	}, bForceSingleThread);
 
-		// Normalise
-		if (PSum > SMALL_NUMBER)
+	// Reduce into the first task
+	for (int32 Task = 1; Task < TaskNum; Task++)
+	{
+		for (int32 Di = 0; Di < DNum; Di++)
 		{
-			for (int32 Pi = 0; Pi < PNum; Pi++)
-			{
-				Rs[Di][Pi] /= PSum;
-			}
+			Stats[Di] += Stats[Task * DNum + Di];
 		}
 	}
+}
+
+float FGMM::Step(bool bForceSingleThread)
+{
+	const int32 DNum = Distributions.Num();
+	const int32 PNum = Points.Num();
+	if (PNum == 0) return 0.0f;
+
+	// Pdf is weighted by Pi already and gets weighted once more here
+	TArray<FGMMFactor> Factors;
+	Factors.Reserve(DNum);
+	for (const FGMMDistribution& Distribution : Distributions)
+	{
+		Factors.Emplace(Distribution, Distribution.Pi * Distribution.Pi);
+	}
+
+	TArray<FGMMStats> Stats;
+	// At 1 every density is below tolerance of its peak and the tree would skip everything
+	if (Tolerance > 0.0f && Tolerance < 1.0f)
+	{
+		// Building the tree costs more than walking it, so it's only rebuilt once the points changed
+		const uint32 Crc = FCrc::MemCrc32(Points.GetData(), PNum * sizeof(FVector));
+		if (!Tree.IsValid() || TreeNum != PNum || TreeCrc != Crc)
+		{
+			Tree = MakeShared<const GMM::FTree>(Points);
+			TreeCrc = Crc;
+			TreeNum = PNum;
+		}
+		Tree->EStep(Factors, Tolerance, Stats, bForceSingleThread);
+	}
+	else
+	{
+		EStep(Factors, Stats, bForceSingleThread);
+	}
 
 	TArray<float> Rns;
 
-	// Normalise
+	// Normalise, distributions with next to no weight are left unnormalised
 	float DSum = 0.0f;
 	Rns.SetNumZeroed(DNum);
 	for (int32 Di = 0; Di < DNum; Di++)
 	{
 		// Compute Pi
-		for (int32 Pi = 0; Pi < PNum; Pi++)
-		{
-			Rns[Di] += Rs[Di][Pi];
-		}
+		Rns[Di] = Stats[Di].Weight > SMALL_NUMBER ? 1.0f : Stats[Di].Weight;
 		DSum += Rns[Di];
 	}
 
@@ -108,28 +843,26 @@ float FGMM::Step()
 		for (int32 Di = 0; Di < DNum; Di++)
 		{
 			FGMMDistribution& Distribution = Distributions[Di];
+			const FGMMStats& Sums = Stats[Di];
 
 			// Compute Pi
 			Distribution.Pi = Rns[Di] / DSum;
 
-			// Compute Mu
-			const FVector OldMu = Distribution.Mu;
-			Distribution.Mu = FVector::ZeroVector;
-			for (int32 Pi = 0; Pi < PNum; Pi++)
+			// Distributions without any weight keep their shape
+			if (Sums.Weight <= 0.0)
 			{
-				Distribution.Mu += Points[Pi] * (Rs[Di][Pi] / Rns[Di]);
+				continue;
 			}
 
+			// Compute Mu
+			const FVector OldMu = Distribution.Mu;
+			Distribution.Mu = Sums.GetMu();
+
 			Change += (OldMu - Distribution.Mu).SizeSquared();
 
 			// Compute cov
 			const FMatrix3x3 OldCov = Distribution.Cov;
-			Distribution.Cov = FMatrix3x3();
-			for (int32 Pi = 0; Pi < PNum; Pi++)
-			{
-				const FVector Delta = Points[Pi] - Distribution.Mu;
-				Distribution.Cov += FMatrix3x3(Delta, Delta) * (Rs[Di][Pi] / Rns[Di]);
-			}
+			Distribution.Cov = Sums.GetCov();
 
 			// Regularisation term
 			Distribution.Cov += FMatrix3x3::Identity;
@@ -141,22 +874,101 @@ float FGMM::Step()
 
 void FGMM::Simplify(float Threshold)
 {
-	for (auto Its = Distributions.CreateIterator(); Its; ++Its)
+	const int32 DNum = Distributions.Num();
+	if (DNum < 2 || Threshold <= 0.0f) return;
+
+	// Merging needs means closer than the threshold, so only neighbouring cells are compared
+	TArray<FVector> Means;
+	Means.Reserve(DNum);
+	for (const FGMMDistribution& Distribution : Distributions)
+	{
+		Means.Emplace(Distribution.Mu);
+	}
+	const GMM::FGrid Grid(Means, Threshold);
+
+	// Every distribution merges into the first one close enough to it
+	TArray<int32> Targets;
+	Targets.Init(INDEX_NONE, DNum);
+	for (int32 Di = 0; Di < DNum; Di++)
 	{
-		for (auto Ots = Its + 1; Ots; ++Ots)
+		if (Targets[Di] != INDEX_NONE) continue;
+
+		const FGMMDistribution& Distribution = Distributions[Di];
+		Grid.ForEachNear(Distribution.Mu, [&](int32 Dj)
 		{
-			const float Energy = (Its->Mu - Ots->Mu).SizeSquared() + (Its->Cov - Ots->Cov).SizeSquared();
-			if (Energy < Threshold * Threshold)
+			if (Dj > Di && Targets[Dj] == INDEX_NONE)
 			{
-				Its.RemoveCurrent();
-				break;
+				const FGMMDistribution& Other = Distributions[Dj];
+				const float Energy = (Distribution.Mu - Other.Mu).SizeSquared() + (Distribution.Cov - Other.Cov).SizeSquared();
+				if (Energy < Threshold * Threshold)
+				{
+					Targets[Dj] = Di;
+				}
+			}
+		});
+	}
+
+	// Combined moments, weighted by Pi
+	TArray<FGMMStats> Merged;
+	Merged.Reserve(DNum);
+	for (const FGMMDistribution& Distribution : Distributions)
+	{
+		Merged.Emplace_GetRef(Distribution.Mu).Add(Distribution.Pi, Distribution.Mu, Distribution.Cov);
+	}
+
+	// Running statistics get merged the same way if they are in use
+	const bool bRunning = Running.Num() == DNum;
+	for (int32 Dj = 0; Dj < DNum; Dj++)
+	{
+		const int32 Di = Targets[Dj];
+		if (Di != INDEX_NONE)
+		{
+			Merged[Di] += Merged[Dj];
+			if (bRunning)
+			{
+				Running[Di] += Running[Dj];
 			}
 		}
 	}
+
+	int32 Num = 0;
+	for (int32 Di = 0; Di < DNum; Di++)
+	{
+		if (Targets[Di] != INDEX_NONE) continue;
+
+		FGMMDistribution& Distribution = Distributions[Di];
+		const FGMMStats& Stats = Merged[Di];
+		if (Stats.Weight > Distribution.Pi)
+		{
+			// Only distributions that took on any weight change shape
+			Distribution.Pi = Stats.Weight;
+			Distribution.Mu = Stats.GetMu();
+			Distribution.Cov = Stats.GetCov();
+		}
+
+		Distributions[Num] = Distribution;
+		if (bRunning)
+		{
+			Running[Num] = Running[Di];
+		}
+		Num++;
+	}
+
+	Distributions.SetNum(Num);
+	if (bRunning)
+	{
+		Running.SetNum(Num);
+	}
 }
 
 void FGMM::AddPoint(const FVector& Point)
 {
+	if (bOnline)
+	{
+		StreamPoint(Point);
+		return;
+	}
+
 	Points.Emplace(Point);
 
 	FGMMDistribution Distribution;
@@ -166,6 +978,119 @@ void FGMM::AddPoint(const FVector& Point)
 	Distributions.Emplace(Distribution);
 }
 
+void FGMM::Initialize(int32 Num, int32 Iterations, int32 Seed)
+{
+	const int32 PNum = Points.Num();
+	Distributions.Reset();
+	Running.Reset();
+	if (PNum == 0 || Num <= 0) return;
+
+	FRandomStream Stream(Seed);
+
+	// k-means++, next centers are picked proportional to squared distance to the closest center so far
+	TArray<FVector> Centers;
+	Centers.Emplace(Points[Stream.RandHelper(PNum)]);
+
+	TArray<double> Distances;
+	Distances.Init(TNumericLimits<double>::Max(), PNum);
+	while (true)
+	{
+		double Total = 0.0;
+		for (int32 Pi = 0; Pi < PNum; Pi++)
+		{
+			Distances[Pi] = FMath::Min(Distances[Pi], FVector::DistSquared(Points[Pi], Centers.Last()));
+			Total += Distances[Pi];
+		}
+
+		// Every point sits on a center already
+		if (Centers.Num() >= Num || Total <= 0.0)
+		{
+			break;
+		}
+
+		double Pick = Stream.FRand() * Total;
+		int32 Next = 0;
+		while (Next < PNum - 1 && (Pick -= Distances[Next]) >= 0.0)
+		{
+			Next++;
+		}
+		Centers.Emplace(Points[Next]);
+	}
+
+	// Lloyd iterations, nearest centers are looked up on a grid
+	TArray<int32> Assignments;
+	Assignments.SetNumUninitialized(PNum);
+	const int32 BatchNum = FMath::DivideAndRoundUp(PNum, GMM_BATCH_SIZE);
+	for (int32 Iteration = 0; ; Iteration++)
+	{
+		const GMM::FGrid Grid(Centers);
+		ParallelFor(BatchNum, [&](int32 Bi)
+		{
+			const int32 End = FMath::Min((Bi + 1) * GMM_BATCH_SIZE, PNum);
+			for (int32 Pi = Bi * GMM_BATCH_SIZE; Pi < End; Pi++)
+			{
+				Assignments[Pi] = Grid.FindNearest(Points[Pi]);
+			}
+		});
+
+		if (Iteration >= Iterations)
+		{
+			break;
+		}
+
+		// Move centers to the mean of their points
+		TArray<FVector> Sums;
+		TArray<int32> Counts;
+		Sums.Init(FVector::ZeroVector, Centers.Num());
+		Counts.Init(0, Centers.Num());
+		for (int32 Pi = 0; Pi < PNum; Pi++)
+		{
+			Sums[Assignments[Pi]] += Points[Pi];
+			Counts[Assignments[Pi]]++;
+		}
+
+		bool bMoved = false;
+		for (int32 Ci = 0; Ci < Centers.Num(); Ci++)
+		{
+			if (Counts[Ci] > 0)
+			{
+				const FVector Center = Sums[Ci] / Counts[Ci];
+				bMoved |= Center != Centers[Ci];
+				Centers[Ci] = Center;
+			}
+		}
+
+		// Assignments are still current
+		if (!bMoved)
+		{
+			break;
+		}
+	}
+
+	// One distribution per cluster, empty clusters are dropped
+	TArray<FGMMStats> Stats;
+	for (const FVector& Center : Centers)
+	{
+		Stats.Emplace(Center);
+	}
+	for (int32 Pi = 0; Pi < PNum; Pi++)
+	{
+		Stats[Assignments[Pi]].Add(1.0, Points[Pi]);
+	}
+
+	for (const FGMMStats& Cluster : Stats)
+	{
+		if (Cluster.Weight > 0.0)
+		{
+			FGMMDistribution Distribution;
+			Distribution.Mu = Cluster.GetMu();
+			Distribution.Cov = Cluster.GetCov() + FMatrix3x3::Identity;
+			Distribution.Pi = Cluster.Weight / PNum;
+			Distributions.Emplace(Distribution);
+		}
+	}
+}
+
 void FGMM::EM(int32 MaxIterations, float Threshold)
 {
 	for (FGMMDistribution& Distribution : Distributions)
@@ -180,3 +1105,143 @@ void FGMM::EM(int32 MaxIterations, float Threshold)
 		Simplify(Threshold);
 	}
 }
+
+void FGMM::StreamPoint(const FVector& Point)
+{
+	// Distributions may have been changed from outside since the last point
+	if (Running.Num() != Distributions.Num())
+	{
+		SeedRunning();
+	}
+
+	const int32 DNum = Distributions.Num();
+	TArray<float, TInlineAllocator<32>> Rs;
+	Rs.SetNumUninitialized(DNum);
+
+	// Responsibilities are normalised over distributions, like regular EM
+	float RSum = 0.0f;
+	float Nearest = TNumericLimits<float>::Max();
+	int32 NearestIndex = INDEX_NONE;
+	for (int32 Di = 0; Di < DNum; Di++)
+	{
+		const FGMMFactor Factor(Distributions[Di], Distributions[Di].Pi);
+		Rs[Di] = Factor.Pdf(Point);
+		RSum += Rs[Di];
+
+		const float Distance = Factor.Distance(Point);
+		if (Distance < Nearest)
+		{
+			Nearest = Distance;
+			NearestIndex = Di;
+		}
+	}
+
+	for (FGMMStats& Stats : Running)
+	{
+		Stats.Scale(Forgetting);
+	}
+
+	bool bSpawn = Nearest > SpawnDistance * SpawnDistance || RSum < SMALL_NUMBER;
+	if (bSpawn && MaxDistributions > 0 && DNum >= MaxDistributions)
+	{
+		// Make room, a lone distribution takes the point instead
+		bSpawn = MergeClosest();
+	}
+
+	if (bSpawn)
+	{
+		FGMMStats& Stats = Running.Emplace_GetRef(Point);
+		Stats.Add(1.0, Point);
+
+		FGMMDistribution Distribution;
+		Distribution.Cov = FMatrix3x3::Identity;
+		Distribution.Mu = Point;
+		Distributions.Emplace(Distribution);
+	}
+	else if (RSum < SMALL_NUMBER)
+	{
+		Running[NearestIndex].Add(1.0, Point);
+	}
+	else
+	{
+		for (int32 Di = 0; Di < DNum; Di++)
+		{
+			Running[Di].Add(Rs[Di] / RSum, Point);
+		}
+	}
+
+	// MStep from running statistics
+	double Total = 0.0;
+	for (const FGMMStats& Stats : Running)
+	{
+		Total += Stats.Weight;
+	}
+
+	for (int32 Di = 0; Di < Distributions.Num(); Di++)
+	{
+		FGMMDistribution& Distribution = Distributions[Di];
+		const FGMMStats& Stats = Running[Di];
+		Distribution.Pi = Stats.Weight / Total;
+		if (Stats.Weight > SMALL_NUMBER)
+		{
+			Distribution.Mu = Stats.GetMu();
+			Distribution.Cov = Stats.GetCov() + FMatrix3x3::Identity;
+		}
+	}
+}
+
+void FGMM::SeedRunning()
+{
+	// Distributions count as many points as their share of what was added so far
+	const int32 Total = FMath::Max(Points.Num(), Distributions.Num());
+
+	Running.Reset();
+	for (const FGMMDistribution& Distribution : Distributions)
+	{
+		// Without the regularisation term, which gets added back on every update
+		FGMMStats& Stats = Running.Emplace_GetRef(Distribution.Mu);
+		Stats.Add(FMath::Max(Distribution.Pi * Total, KINDA_SMALL_NUMBER), Distribution.Mu, Distribution.Cov - FMatrix3x3::Identity);
+	}
+}
+
+bool FGMM::MergeClosest()
+{
+	const int32 DNum = Distributions.Num();
+	if (DNum < 2)
+	{
+		return false;
+	}
+
+	// Closest pair is the closest of the nearest neighbours, looked up on a grid
+	TArray<FVector> Means;
+	Means.Reserve(DNum);
+	for (const FGMMDistribution& Distribution : Distributions)
+	{
+		Means.Emplace(Distribution.Mu);
+	}
+	const GMM::FGrid Grid(Means);
+
+	int32 Keep = INDEX_NONE, Drop = INDEX_NONE;
+	double Closest = TNumericLimits<double>::Max();
+	for (int32 Di = 0; Di < DNum; Di++)
+	{
+		const int32 Dj = Grid.FindNearest(Means[Di], Di);
+		const double Distance = FVector::DistSquared(Means[Di], Means[Dj]);
+		if (Distance < Closest)
+		{
+			Closest = Distance;
+			Keep = FMath::Min(Di, Dj);
+			Drop = FMath::Max(Di, Dj);
+		}
+	}
+
+	if (Drop != INDEX_NONE)
+	{
+		// Summed statistics describe both sets of points, mean and cov follow on the next update
+		Running[Keep] += Running[Drop];
+		Running.RemoveAt(Drop);
+		Distributions.RemoveAt(Drop);
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,389 @@
+#include "Structures/GMM.h"
+
+#include "Misc/AutomationTest.h"
+
+namespace GMMTest
+{
+    // Gaussian-ish blobs around a few centers
+    TArray<FVector> RandomClusters(int32 Seed, const TArray<FVector>& Centers, int32 NumPerCenter, float Spread)
+    {
+        FRandomStream Stream(Seed);
+        TArray<FVector> Points;
+        for (const FVector& Center : Centers)
+        {
+            for (int32 Index = 0; Index < NumPerCenter; Index++)
+            {
+                const FVector Offset(
+                    Stream.FRandRange(-1.0f, 1.0f) + Stream.FRandRange(-1.0f, 1.0f),
+                    Stream.FRandRange(-1.0f, 1.0f) + Stream.FRandRange(-1.0f, 1.0f),
+                    Stream.FRandRange(-1.0f, 1.0f) + Stream.FRandRange(-1.0f, 1.0f));
+                Points.Emplace(Center + Offset * Spread);
+            }
+        }
+        return Points;
+    }
+
+    FGMMDistribution MakeDistribution(const FVector& Mu, float Variance, float Pi)
+    {
+        FGMMDistribution Distribution;
+        Distribution.Mu = Mu;
+        Distribution.Cov = FMatrix3x3::Identity * Variance;
+        Distribution.Pi = Pi;
+        return Distribution;
+    }
+}
+
+DEFINE_SPEC(GMMSpec, "Angry.GMMSpec", EAutomationTestFlags::ProductFilter | EAutomationTestFlags::ApplicationContextMask)
+void GMMSpec::Define()
+{
+    using namespace GMMTest;
+
+    Describe("FGMMFactor", [this]()
+    {
+        It("should evaluate batches like single points", [this]()
+        {
+            const TArray<FVector> Points = RandomClusters(1, { FVector(0.0f), FVector(5.0f, -3.0f, 2.0f) }, 9, 3.0f);
+            const FGMMPoints Batch(Points);
+            TestEqual("Padding", Batch.X.Num() % 4, 0);
+
+            FGMMDistribution Distribution = MakeDistribution(FVector(1.0f, 0.0f, -1.0f), 4.0f, 0.5f);
+            Distribution.Cov.X.Y = Distribution.Cov.Y.X = 1.5f;
+            Distribution.Cov.Y.Z = Distribution.Cov.Z.Y = -0.5f;
+
+            const FGMMFactor Factor(Distribution, Distribution.Pi);
+            TArray<float> Out;
+            Out.SetNumUninitialized(Batch.X.Num());
+            Factor.Pdf(Batch, 0, Points.Num(), Out.GetData());
+
+            for (int32 Index = 0; Index < Points.Num(); Index++)
+            {
+                const float Expected = Distribution.Pdf(Points[Index]);
+                TestTrue("Pdf", FMath::Abs(Out[Index] - Expected) <= Expected * 1e-4f + 1e-12f);
+            }
+
+            // Mahalanobis distance against the adjugate inverse of the correlated covariance, normalised by (2 pi) ^ 3
+            const FMatrix3x3& C = Distribution.Cov;
+            const FVector Adjugate[3] = {
+                FVector(C.Y.Y * C.Z.Z - C.Y.Z * C.Z.Y, C.X.Z * C.Z.Y - C.X.Y * C.Z.Z, C.X.Y * C.Y.Z - C.X.Z * C.Y.Y),
+                FVector(C.Y.Z * C.Z.X - C.Y.X * C.Z.Z, C.X.X * C.Z.Z - C.X.Z * C.Z.X, C.X.Z * C.Y.X - C.X.X * C.Y.Z),
+                FVector(C.Y.X * C.Z.Y - C.Y.Y * C.Z.X, C.X.Y * C.Z.X - C.X.X * C.Z.Y, C.X.X * C.Y.Y - C.X.Y * C.Y.X) };
+            const double Det = C.X.X * Adjugate[0].X + C.X.Y * Adjugate[1].X + C.X.Z * Adjugate[2].X;
+            const FVector Delta = Points[0] - Distribution.Mu;
+            const FVector Solved = FVector(Adjugate[0] | Delta, Adjugate[1] | Delta, Adjugate[2] | Delta) / Det;
+            TestTrue("CholeskyInvert", (Distribution.Cov.CholeskyInvert(Delta) - Solved).Size() <= Solved.Size() * 1e-4);
+            const double Distance = Delta | Solved;
+            const double Expected = FMath::Exp(-0.5 * Distance) * Distribution.Pi / (248.0502134424 * Distribution.Cov.Det());
+            TestTrue("Inverse", FMath::Abs(Factor.Pdf(Points[0]) - Expected) <= Expected * 1e-4 + 1e-12);
+        });
+
+        It("should bound distances over a box", [this]()
+        {
+            FGMMDistribution Distribution = MakeDistribution(FVector(1.0f, 0.0f, -1.0f), 4.0f, 1.0f);
+            Distribution.Cov.X.Y = Distribution.Cov.Y.X = 1.5f;
+            Distribution.Cov.X.Z = Distribution.Cov.Z.X = -1.0f;
+            const FGMMFactor Factor(Distribution, 1.0f);
+
+            const FVector Min(2.0f, -3.0f, 0.0f), Max(5.0f, 1.0f, 2.0f);
+            float Lower, Upper;
+            Factor.Distance(Min, Max, Lower, Upper);
+
+            FRandomStream Stream(8);
+            for (int32 Index = 0; Index < 1000; Index++)
+            {
+                const FVector Point(Stream.FRandRange(Min.X, Max.X), Stream.FRandRange(Min.Y, Max.Y), Stream.FRandRange(Min.Z, Max.Z));
+                const float Distance = Factor.Distance(Point);
+                TestTrue("Lower", Lower <= Distance + 1e-4f);
+                TestTrue("Upper", Distance <= Upper + 1e-4f);
+            }
+        });
+
+        It("should have no density for degenerate covariances", [this]()
+        {
+            FGMMDistribution Distribution = MakeDistribution(FVector(0.0f), 0.0f, 1.0f);
+            const FGMMPoints Batch({ FVector(0.0f), FVector(1.0f) });
+            TArray<float> Out;
+            Out.SetNumUninitialized(Batch.X.Num());
+            FGMMFactor(Distribution, 1.0f).Pdf(Batch, 0, 2, Out.GetData());
+            TestEqual("First", Out[0], 0.0f);
+            TestEqual("Second", Out[1], 0.0f);
+        });
+    });
+
+    Describe("FGMM::Step", [this]()
+    {
+        It("should move distributions onto separated clusters", [this]()
+        {
+            const FVector A(0.0f), B(100.0f, 0.0f, 0.0f);
+
+            FGMM GMM;
+            GMM.Points = RandomClusters(2, { A, B }, 500, 2.0f);
+            GMM.Distributions.Emplace(MakeDistribution(A + FVector(6.0f, 4.0f, 0.0f), 25.0f, 0.5f));
+            GMM.Distributions.Emplace(MakeDistribution(B - FVector(6.0f, 0.0f, 4.0f), 25.0f, 0.5f));
+
+            for (int32 Iteration = 0; Iteration < 30; Iteration++)
+            {
+                GMM.Step();
+            }
+
+            TestTrue("A", (GMM.Distributions[0].Mu - A).Size() < 1.0f);
+            TestTrue("B", (GMM.Distributions[1].Mu - B).Size() < 1.0f);
+        });
+
+        It("should fit the same on worker threads as on one", [this]()
+        {
+            FGMM Parallel;
+            Parallel.Points = RandomClusters(3, { FVector(0.0f), FVector(40.0f, 10.0f, 0.0f), FVector(0.0f, 50.0f, -20.0f) }, 3000, 5.0f);
+            for (int32 Index = 0; Index < 3; Index++)
+            {
+                Parallel.Distributions.Emplace(MakeDistribution(Parallel.Points[Index * 1000], 100.0f, 1.0f / 3));
+            }
+            FGMM Single = Parallel;
+
+            for (int32 Iteration = 0; Iteration < 5; Iteration++)
+            {
+                Parallel.Step();
+                Single.Step(true);
+            }
+
+            for (int32 Index = 0; Index < 3; Index++)
+            {
+                TestTrue("Mu", (Parallel.Distributions[Index].Mu - Single.Distributions[Index].Mu).Size() < 1e-3f);
+                TestTrue("Cov", (Parallel.Distributions[Index].Cov - Single.Distributions[Index].Cov).SizeSquared() < 1e-3f);
+                TestEqual("Pi", Parallel.Distributions[Index].Pi, Single.Distributions[Index].Pi, 1e-5f);
+            }
+        });
+    });
+
+    Describe("FGMM::Tolerance", [this]()
+    {
+        It("should fit about the same on a tree as point by point", [this]()
+        {
+            FGMM Tree;
+            Tree.Points = RandomClusters(9, { FVector(0.0f), FVector(40.0f, 10.0f, 0.0f), FVector(0.0f, 50.0f, -20.0f) }, 3000, 5.0f);
+            for (int32 Index = 0; Index < 3; Index++)
+            {
+                Tree.Distributions.Emplace(MakeDistribution(Tree.Points[Index * 3000], 100.0f, 1.0f / 3));
+            }
+            FGMM Exact = Tree;
+            Tree.Tolerance = 1e-3f;
+
+            for (int32 Iteration = 0; Iteration < 5; Iteration++)
+            {
+                Tree.Step();
+                Exact.Step();
+            }
+
+            for (int32 Index = 0; Index < 3; Index++)
+            {
+                const FGMMDistribution& Expected = Exact.Distributions[Index];
+                TestTrue("Mu", (Tree.Distributions[Index].Mu - Expected.Mu).Size() < 0.05f);
+                TestTrue("Cov", (Tree.Distributions[Index].Cov - Expected.Cov).SizeSquared() < Expected.Cov.SizeSquared() * 1e-4f);
+                TestEqual("Pi", Tree.Distributions[Index].Pi, Expected.Pi, 1e-3f);
+            }
+        });
+
+        It("should evaluate every point at a tolerance of one", [this]()
+        {
+            FGMM Tree;
+            Tree.Points = RandomClusters(11, { FVector(0.0f) }, 500, 2.0f);
+            Tree.Distributions.Emplace(MakeDistribution(FVector(1.0f, 0.0f, 0.0f), 9.0f, 1.0f));
+            FGMM Exact = Tree;
+            Tree.Tolerance = 1.0f;
+
+            Tree.Step();
+            Exact.Step();
+            TestEqual("Mu", Tree.Distributions[0].Mu, Exact.Distributions[0].Mu, 1e-6);
+        });
+
+        It("should handle more coincident points than fit a leaf", [this]()
+        {
+            FGMM Tree;
+            // Coincident points can't be split and end up in a single leaf
+            Tree.Points.Init(FVector(3.0f, -2.0f, 1.0f), 300);
+            Tree.Points.Append(RandomClusters(10, { FVector(20.0f, 0.0f, 0.0f) }, 200, 2.0f));
+            Tree.Distributions.Emplace(MakeDistribution(FVector(2.0f, -2.0f, 1.0f), 9.0f, 0.5f));
+            Tree.Distributions.Emplace(MakeDistribution(FVector(19.0f, 0.0f, 0.0f), 9.0f, 0.5f));
+            FGMM Exact = Tree;
+            Tree.Tolerance = 1e-3f;
+
+            Tree.Step();
+            Exact.Step();
+            for (int32 Index = 0; Index < 2; Index++)
+            {
+                TestTrue("Mu", (Tree.Distributions[Index].Mu - Exact.Distributions[Index].Mu).Size() < 0.05f);
+                TestEqual("Pi", Tree.Distributions[Index].Pi, Exact.Distributions[Index].Pi, 1e-3f);
+            }
+        });
+    });
+
+    Describe("FGMM::Simplify", [this]()
+    {
+        It("should merge close distributions into their combined moments", [this]()
+        {
+            FGMM GMM;
+            GMM.Distributions.Emplace(MakeDistribution(FVector(0.0f), 1.0f, 0.25f));
+            GMM.Distributions.Emplace(MakeDistribution(FVector(1.0f, 0.0f, 0.0f), 1.0f, 0.25f));
+            GMM.Distributions.Emplace(MakeDistribution(FVector(100.0f, 0.0f, 0.0f), 1.0f, 0.5f));
+            GMM.Simplify(2.0f);
+
+            TestEqual("Num", GMM.Distributions.Num(), 2);
+            const FGMMDistribution& Merged = GMM.Distributions[0];
+            TestEqual("Pi", Merged.Pi, 0.5f, 1e-6f);
+            TestEqual("Mu", Merged.Mu, FVector(0.5f, 0.0f, 0.0f), 1e-6);
+
+            // Spread of the means adds onto the covariance along X
+            TestEqual("Cov X", Merged.Cov.X.X, 1.25f, 1e-5f);
+            TestEqual("Cov Y", Merged.Cov.Y.Y, 1.0f, 1e-5f);
+            TestEqual("Cov XY", Merged.Cov.X.Y, 0.0f, 1e-5f);
+            TestEqual("Far", GMM.Distributions[1].Mu, FVector(100.0f, 0.0f, 0.0f), 1e-6);
+        });
+
+        It("should only merge neighbours", [this]()
+        {
+            // Lattice spaced further than the threshold, every site twice
+            FGMM GMM;
+            for (int32 Copy = 0; Copy < 2; Copy++)
+            {
+                for (int32 Index = 0; Index < 1000; Index++)
+                {
+                    const FVector Site(Index % 10, Index / 10 % 10, Index / 100);
+                    GMM.Distributions.Emplace(MakeDistribution(Site * 10.0f + FVector(Copy * 0.5f), 4.0f, 0.0005f));
+                }
+            }
+            GMM.Simplify(5.0f);
+
+            TestEqual("Num", GMM.Distributions.Num(), 1000);
+            for (int32 Index = 0; Index < GMM.Distributions.Num(); Index++)
+            {
+                TestEqual("Pi", GMM.Distributions[Index].Pi, 0.001f, 1e-6f);
+            }
+        });
+    });
+
+    Describe("FGMM::Initialize", [this]()
+    {
+        It("should seed one distribution per cluster", [this]()
+        {
+            const TArray<FVector> Centers = { FVector(0.0f), FVector(60.0f, 0.0f, 0.0f), FVector(0.0f, 60.0f, 0.0f), FVector(0.0f, 0.0f, 60.0f) };
+
+            FGMM GMM;
+            GMM.Points = RandomClusters(7, Centers, 2000, 3.0f);
+            GMM.Initialize(4);
+            TestEqual("Num", GMM.Distributions.Num(), 4);
+
+            for (const FVector& Center : Centers)
+            {
+                const int32 Index = GMM.Distributions.IndexOfByPredicate([&Center](const FGMMDistribution& Distribution)
+                {
+                    return (Distribution.Mu - Center).Size() < 1.0f;
+                });
+                TestTrue("Found", Index != INDEX_NONE);
+                if (Index != INDEX_NONE)
+                {
+                    TestEqual("Pi", GMM.Distributions[Index].Pi, 0.25f, 0.01f);
+                }
+            }
+
+            // Already on the clusters, so EM keeps the means in place
+            const FGMM Seeded = GMM;
+            GMM.Step();
+            for (int32 Index = 0; Index < GMM.Distributions.Num(); Index++)
+            {
+                TestTrue("Converged", (GMM.Distributions[Index].Mu - Seeded.Distributions[Index].Mu).Size() < 0.5f);
+            }
+        });
+
+        It("should not seed more distributions than distinct points", [this]()
+        {
+            FGMM GMM;
+            GMM.Points = { FVector(1.0f), FVector(1.0f), FVector(1.0f), FVector(5.0f) };
+            GMM.Initialize(3);
+            TestEqual("Num", GMM.Distributions.Num(), 2);
+        });
+    });
+
+    Describe("FGMMStats", [this]()
+    {
+        It("should describe the same points after a rebase", [this]()
+        {
+            const TArray<FVector> Points = RandomClusters(4, { FVector(10.0f, -20.0f, 5.0f) }, 200, 3.0f);
+            FGMMStats Near(Points[0]), Far(FVector(1000.0f, 0.0f, 0.0f));
+            for (int32 Index = 0; Index < Points.Num(); Index++)
+            {
+                Near.Add(Index % 3 + 1, Points[Index]);
+                Far.Add(Index % 3 + 1, Points[Index]);
+            }
+
+            Far.Rebase(Points[0]);
+            TestEqual("Mu", Far.GetMu(), Near.GetMu(), 1e-6);
+            TestTrue("Cov", (Far.GetCov() - Near.GetCov()).SizeSquared() < 1e-8);
+
+            // Halves added separately merge into the whole
+            FGMMStats First(Points[0]), Second(Points[1]);
+            for (int32 Index = 0; Index < Points.Num(); Index++)
+            {
+                (Index < Points.Num() / 2 ? First : Second).Add(Index % 3 + 1, Points[Index]);
+            }
+            First += Second;
+            TestEqual("Merged Mu", First.GetMu(), Near.GetMu(), 1e-6);
+            TestTrue("Merged Cov", (First.GetCov() - Near.GetCov()).SizeSquared() < 1e-8);
+        });
+    });
+
+    Describe("FGMM online", [this]()
+    {
+        It("should find clusters from a stream without keeping points", [this]()
+        {
+            const FVector A(0.0f), B(100.0f, 0.0f, 0.0f);
+            const TArray<FVector> Points = RandomClusters(5, { A, B }, 1000, 2.0f);
+
+            // Interleave so both clusters show up early
+            FGMM GMM;
+            GMM.bOnline = true;
+            GMM.MaxDistributions = 4;
+            for (int32 Index = 0; Index < 1000; Index++)
+            {
+                GMM.AddPoint(Points[Index]);
+                GMM.AddPoint(Points[Index + 1000]);
+            }
+
+            TestEqual("Points", GMM.Points.Num(), 0);
+            TestTrue("Capped", GMM.Distributions.Num() <= 4);
+
+            // Distributions may split a cluster, but their mass and mean stay on it
+            for (const FVector& Center : { A, B })
+            {
+                double Pi = 0.0;
+                FVector Mu = FVector::ZeroVector;
+                for (const FGMMDistribution& Distribution : GMM.Distributions)
+                {
+                    if ((Distribution.Mu - Center).Size() < 10.0f)
+                    {
+                        Pi += Distribution.Pi;
+                        Mu += Distribution.Mu * Distribution.Pi;
+                    }
+                }
+                TestEqual("Pi", Pi, 0.5, 0.05);
+                TestTrue("Mu", Pi > 0.0 && (Mu / Pi - Center).Size() < 0.5f);
+            }
+        });
+
+        It("should follow a moving source when forgetting", [this]()
+        {
+            const FVector A(0.0f), B(6.0f, 0.0f, 0.0f);
+            const TArray<FVector> Points = RandomClusters(6, { A, B }, 2000, 1.0f);
+
+            FGMM GMM;
+            GMM.bOnline = true;
+            GMM.MaxDistributions = 1;
+            GMM.Forgetting = 0.99f;
+            for (const FVector& Point : Points)
+            {
+                GMM.AddPoint(Point);
+            }
+
+            TestEqual("Num", GMM.Distributions.Num(), 1);
+            TestTrue("B", (GMM.Distributions[0].Mu - B).Size() < 0.5f);
+        });
+    });
+}
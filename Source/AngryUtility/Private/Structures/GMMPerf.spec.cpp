@@ -0,0 +1,173 @@
+#include "Structures/GMM.h"
+
+#include "Misc/AutomationTest.h"
+
+namespace GMMPerf
+{
+    // Points spread over a few blobs in a 1000 cube
+    TArray<FVector> RandomPoints(int32 Seed, int32 Num, int32 Clusters)
+    {
+        FRandomStream Stream(Seed);
+        TArray<FVector> Centers;
+        for (int32 Index = 0; Index < Clusters; Index++)
+        {
+            Centers.Emplace(FVector(Stream.FRandRange(0.0f, 1000.0f), Stream.FRandRange(0.0f, 1000.0f), Stream.FRandRange(0.0f, 1000.0f)));
+        }
+
+        TArray<FVector> Points;
+        for (int32 Index = 0; Index < Num; Index++)
+        {
+            const FVector Offset(Stream.FRandRange(-50.0f, 50.0f), Stream.FRandRange(-50.0f, 50.0f), Stream.FRandRange(-50.0f, 50.0f));
+            Points.Emplace(Centers[Index % Clusters] + Offset);
+        }
+        return Points;
+    }
+
+    // One distribution per cluster, started off a random point
+    FGMM MakeGMM(const TArray<FVector>& Points, int32 Clusters)
+    {
+        FGMM GMM;
+        GMM.Points = Points;
+        for (int32 Index = 0; Index < Clusters; Index++)
+        {
+            FGMMDistribution Distribution;
+            Distribution.Mu = Points[Index];
+            Distribution.Cov = FMatrix3x3::Identity * 2500.0f;
+            Distribution.Pi = 1.0f / Clusters;
+            GMM.Distributions.Emplace(Distribution);
+        }
+        return GMM;
+    }
+}
+
+DEFINE_SPEC(GMMPerfSpec, "Angry.GMMPerfSpec", EAutomationTestFlags::PerfFilter | EAutomationTestFlags::ApplicationContextMask)
+void GMMPerfSpec::Define()
+{
+    using namespace GMMPerf;
+
+    Describe("Step", [this]()
+    {
+        It("should report EM steps on 100k points", [this]()
+        {
+            const TArray<FVector> Points = RandomPoints(1, 100000, 16);
+            for (int32 Clusters : { 4, 16, 64 })
+            {
+                auto Run = [&Points, Clusters](bool bForceSingleThread)
+                {
+                    FGMM GMM = MakeGMM(Points, Clusters);
+                    const int32 Steps = 5;
+                    const double Start = FPlatformTime::Seconds();
+                    for (int32 Step = 0; Step < Steps; Step++)
+                    {
+                        GMM.Step(bForceSingleThread);
+                    }
+                    return (FPlatformTime::Seconds() - Start) * 1000.0 / Steps;
+                };
+
+                const double Single = Run(true);
+                const double Parallel = Run(false);
+                AddInfo(FString::Printf(TEXT("%d distributions: %.2fms/step on one thread, %.2fms/step on workers (%.1fx)"),
+                    Clusters, Single, Parallel, Single / Parallel));
+            }
+        });
+    });
+
+    Describe("Tolerance", [this]()
+    {
+        It("should report tree EM steps on 100k points", [this]()
+        {
+            const TArray<FVector> Points = RandomPoints(1, 100000, 16);
+            for (int32 Clusters : { 16, 64 })
+            {
+                auto Run = [&Points, Clusters](float Tolerance)
+                {
+                    // Start from seeded clusters so distributions are compact like in practice
+                    FGMM GMM;
+                    GMM.Points = Points;
+                    GMM.Initialize(Clusters);
+                    GMM.Tolerance = Tolerance;
+                    const int32 Steps = 5;
+                    const double Start = FPlatformTime::Seconds();
+                    for (int32 Step = 0; Step < Steps; Step++)
+                    {
+                        GMM.Step(true);
+                    }
+                    return (FPlatformTime::Seconds() - Start) * 1000.0 / Steps;
+                };
+
+                const double Exact = Run(0.0f);
+                for (float Tolerance : { 1e-4f, 1e-2f })
+                {
+                    const double Tree = Run(Tolerance);
+                    AddInfo(FString::Printf(TEXT("%d distributions: %.2fms/step exact, %.2fms/step at %g tolerance (%.1fx)"),
+                        Clusters, Exact, Tree, Tolerance, Exact / Tree));
+                }
+            }
+        });
+    });
+
+    Describe("Initialize", [this]()
+    {
+        It("should report seeding on 100k points", [this]()
+        {
+            const TArray<FVector> Points = RandomPoints(3, 100000, 16);
+            for (int32 Clusters : { 16, 64, 256 })
+            {
+                FGMM GMM;
+                GMM.Points = Points;
+
+                const double Start = FPlatformTime::Seconds();
+                GMM.Initialize(Clusters);
+                const double Time = FPlatformTime::Seconds() - Start;
+                AddInfo(FString::Printf(TEXT("%d clusters: %.2fms, %d distributions"),
+                    Clusters, Time * 1000.0, GMM.Distributions.Num()));
+            }
+        });
+    });
+
+    Describe("Simplify", [this]()
+    {
+        It("should report merging thousands of distributions", [this]()
+        {
+            for (int32 Num : { 1000, 10000, 100000 })
+            {
+                // Every point its own distribution, like after AddPoint
+                FGMM GMM;
+                for (const FVector& Point : RandomPoints(4, Num, 64))
+                {
+                    GMM.AddPoint(Point);
+                }
+
+                const double Start = FPlatformTime::Seconds();
+                GMM.Simplify(10.0f);
+                const double Time = FPlatformTime::Seconds() - Start;
+                AddInfo(FString::Printf(TEXT("%d distributions: %.2fms, %d left"),
+                    Num, Time * 1000.0, GMM.Distributions.Num()));
+            }
+        });
+    });
+
+    Describe("Streaming", [this]()
+    {
+        It("should report online updates per point", [this]()
+        {
+            const TArray<FVector> Points = RandomPoints(2, 100000, 16);
+            for (int32 MaxDistributions : { 16, 64 })
+            {
+                FGMM GMM;
+                GMM.bOnline = true;
+                GMM.MaxDistributions = MaxDistributions;
+                GMM.Forgetting = 0.999f;
+
+                const double Start = FPlatformTime::Seconds();
+                for (const FVector& Point : Points)
+                {
+                    GMM.AddPoint(Point);
+                }
+                const double Time = FPlatformTime::Seconds() - Start;
+                AddInfo(FString::Printf(TEXT("%d max distributions: %.2fus/point, %d distributions"),
+                    MaxDistributions, Time * 1000000.0 / Points.Num(), GMM.Distributions.Num()));
+            }
+        });
+    });
+}
@@ -152,7 +152,7 @@ FVector FMatrix3x3::CholeskyInvert(const FVector& Input) const
 	if (lYY_ < 0.0) return(Input);
 	const double lYY = FMath::Sqrt(lYY_);
 	if (lYY < SMALL_NUMBER) return(Input);
-	const double lYZ = (Y.Z - lXY * lXZ / lYY);
+	const double lYZ = (Y.Z - lXY * lXZ) / lYY;
 
 	// Cholesky decomposition, third column. Assume Identity on failure.
 	const double lZZ_ = Z.Z - lXZ * lXZ - lYZ * lYZ;
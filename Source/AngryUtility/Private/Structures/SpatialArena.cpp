@@ -0,0 +1,132 @@
+// Maintained by AngryLizard, netliz.net
+
+#include "Structures/SpatialArena.h"
+#include "Misc/ScopeLock.h"
+
+#define SPATIAL_ARENA_ALIGNMENT 16
+
+FSpatialArena::FSpatialArena(SIZE_T BlockSize)
+	: BlockSize(BlockSize), Cursor(nullptr), End(nullptr), ReservedBytes(0), UsedBytes(0), bThreadSafe(false)
+{
+}
+
+FSpatialArena::~FSpatialArena()
+{
+	Reset();
+}
+
+SIZE_T FSpatialArena::AlignSize(SIZE_T Size)
+{
+	return Align(Size, SPATIAL_ARENA_ALIGNMENT);
+}
+
+void* FSpatialArena::Allocate(SIZE_T Size)
+{
+	if (bThreadSafe)
+	{
+		FScopeLock Lock(&Mutex);
+		return AllocateInternal(Size);
+	}
+	return AllocateInternal(Size);
+}
+
+void FSpatialArena::Free(void* Ptr, SIZE_T Size)
+{
+	if (bThreadSafe)
+	{
+		FScopeLock Lock(&Mutex);
+		FreeInternal(Ptr, Size);
+	}
+	else
+	{
+		FreeInternal(Ptr, Size);
+	}
+}
+
+void FSpatialArena::SetThreadSafe(bool bEnable)
+{
+	bThreadSafe = bEnable;
+}
+
+void* FSpatialArena::AllocateInternal(SIZE_T Size)
+{
+	Size = AlignSize(Size);
+	UsedBytes += Size;
+
+	// Recycle freed chunk of the same size
+	const int32 Class = Size / SPATIAL_ARENA_ALIGNMENT;
+	if (FreeLists.IsValidIndex(Class) && FreeLists[Class])
+	{
+		void* Ptr = FreeLists[Class];
+		FreeLists[Class] = *reinterpret_cast<void**>(Ptr);
+		return(Ptr);
+	}
+
+	// Bump from current block
+	if (!Cursor || Cursor + Size > End)
+	{
+		Grow(Size);
+	}
+
+	void* Ptr = Cursor;
+	Cursor += Size;
+	return(Ptr);
+}
+
+void FSpatialArena::FreeInternal(void* Ptr, SIZE_T Size)
+{
+	if (!Ptr)
+	{
+		return;
+	}
+
+	Size = AlignSize(Size);
+	UsedBytes -= Size;
+
+	// Push chunk to the front of its free list
+	const int32 Class = Size / SPATIAL_ARENA_ALIGNMENT;
+	if (!FreeLists.IsValidIndex(Class))
+	{
+		FreeLists.SetNumZeroed(Class + 1);
+	}
+	*reinterpret_cast<void**>(Ptr) = FreeLists[Class];
+	FreeLists[Class] = Ptr;
+}
+
+void FSpatialArena::Reset()
+{
+	for (uint8* Block : Blocks)
+	{
+		FMemory::Free(Block);
+	}
+	Blocks.Empty();
+	FreeLists.Empty();
+
+	Cursor = nullptr;
+	End = nullptr;
+	ReservedBytes = 0;
+	UsedBytes = 0;
+}
+
+SIZE_T FSpatialArena::GetReservedBytes() const
+{
+	return ReservedBytes;
+}
+
+SIZE_T FSpatialArena::GetUsedBytes() const
+{
+	return UsedBytes;
+}
+
+void FSpatialArena::Grow(SIZE_T Size)
+{
+	// Oversized requests get a block of their own
+	const SIZE_T Reserve = FMath::Max(BlockSize, Size);
+	uint8* Block = static_cast<uint8*>(FMemory::Malloc(Reserve, SPATIAL_ARENA_ALIGNMENT));
+	Blocks.Emplace(Block);
+	ReservedBytes += Reserve;
+
+	// Remainder of the previous block is abandoned
+	Cursor = Block;
+	End = Block + Reserve;
+}
@@ -0,0 +1,247 @@
+// Maintained by AngryLizard, netliz.net
+
+#include "Structures/SpatialBuddyTree.h"
+
+namespace SpatialBuddy
+{
+	// Interleave block coordinates into a morton index, x in the lowest bit
+	uint32 Interleave(uint32 X, uint32 Y, uint32 Z)
+	{
+		uint32 Index = 0;
+		for (int32 Bit = 0; Bit < FSpatialBuddyTree::MaxDepth; Bit++)
+		{
+			Index |= ((X >> Bit) & 1) << (Bit * 3 + 0);
+			Index |= ((Y >> Bit) & 1) << (Bit * 3 + 1);
+			Index |= ((Z >> Bit) & 1) << (Bit * 3 + 2);
+		}
+		return(Index);
+	}
+
+	// Extract every third bit of a morton index
+	uint32 Compact(uint32 Index)
+	{
+		uint32 Coord = 0;
+		for (int32 Bit = 0; Bit < FSpatialBuddyTree::MaxDepth; Bit++)
+		{
+			Coord |= ((Index >> (Bit * 3)) & 1) << Bit;
+		}
+		return(Coord);
+	}
+}
+
+FSpatialBuddyTree::FSpatialBuddyTree(const FVector& Location, float Size, float MinSize)
+	: Location(Location), Size(Size), Depths(0), Num(0)
+{
+	while (Depths < MaxDepth && GetBlockSize(Depths + 1) >= MinSize)
+	{
+		Depths++;
+	}
+
+	for (int32 Depth = 0; Depth <= Depths; Depth++)
+	{
+		// Groups of eight siblings never straddle a word
+		const int32 Words = FMath::Max(1, (1 << (Depth * 3)) >> 6);
+		Levels[Depth].Free.SetNumZeroed(Words);
+		Levels[Depth].Allocated.SetNumZeroed(Words);
+
+		// At most 8 top summary words at max depth
+		Levels[Depth].Summary[0].SetNumZeroed((Words + 63) >> 6);
+		Levels[Depth].Summary[1].SetNumZeroed((Levels[Depth].Summary[0].Num() + 63) >> 6);
+	}
+
+	SetFree(0, 0);
+}
+
+bool FSpatialBuddyTree::Insert(const FVector& Bounds, FVector& Result)
+{
+	const int32 Depth = GetFitDepth(Bounds);
+	if (Depth < 0)
+	{
+		return(false);
+	}
+
+	// Closest depth above with a free block
+	int32 From = Depth;
+	while (From >= 0 && Levels[From].FreeNum == 0)
+	{
+		From--;
+	}
+
+	if (From < 0)
+	{
+		return(false);
+	}
+
+	// Split down, keeping the first octant and freeing its buddies
+	int32 Index = TakeFree(From);
+	while (From < Depth)
+	{
+		From++;
+		Index <<= 3;
+		for (int32 Child = 1; Child < 8; Child++)
+		{
+			SetFree(From, Index + Child);
+		}
+	}
+
+	Levels[Depth].Allocated[Index >> 6] |= uint64(1) << (Index & 63);
+	Num++;
+
+	Result = GetBlockCenter(Depth, Index);
+	return(true);
+}
+
+bool FSpatialBuddyTree::Remove(const FVector& Point)
+{
+	for (int32 Depth = 0; Depth <= Depths; Depth++)
+	{
+		int32 Index = LocateBlock(Depth, Point);
+		FLevel& Level = Levels[Depth];
+		if (HasBit(Level.Allocated, Index))
+		{
+			Level.Allocated[Index >> 6] &= ~(uint64(1) << (Index & 63));
+			Num--;
+
+			// Merge upwards while all buddies are free
+			while (Depth > 0)
+			{
+				FLevel& Merge = Levels[Depth];
+				const int32 Shift = (Index & ~7) & 63;
+				const uint64 Siblings = (Merge.Free[Index >> 6] >> Shift) | (uint64(1) << (Index & 7));
+				if ((Siblings & 0xFF) != 0xFF)
+				{
+					break;
+				}
+
+				ClearFree(Depth, Index >> 6, uint64(0xFF) << Shift);
+				Merge.FreeNum -= 7;
+				Index >>= 3;
+				Depth--;
+			}
+
+			SetFree(Depth, Index);
+			return(Num == 0);
+		}
+
+		if (HasBit(Level.Free, Index))
+		{
+			break;
+		}
+	}
+	return(Num == 0);
+}
+
+void FSpatialBuddyTree::Reset()
+{
+	for (int32 Depth = 0; Depth <= Depths; Depth++)
+	{
+		FLevel& Level = Levels[Depth];
+		FMemory::Memzero(Level.Free.GetData(), Level.Free.Num() * sizeof(uint64));
+		FMemory::Memzero(Level.Allocated.GetData(), Level.Allocated.Num() * sizeof(uint64));
+		FMemory::Memzero(Level.Summary[0].GetData(), Level.Summary[0].Num() * sizeof(uint64));
+		FMemory::Memzero(Level.Summary[1].GetData(), Level.Summary[1].Num() * sizeof(uint64));
+		Level.FreeNum = 0;
+	}
+
+	Num = 0;
+	SetFree(0, 0);
+}
+
+int32 FSpatialBuddyTree::GetFitDepth(const FVector& Bounds) const
+{
+	const float Extent = Bounds.GetMax();
+	int32 Depth = -1;
+	while (Depth < Depths && Extent <= GetBlockSize(Depth + 1))
+	{
+		Depth++;
+	}
+	return(Depth);
+}
+
+float FSpatialBuddyTree::GetBlockSize(int32 Depth) const
+{
+	return(Size / (1 << Depth));
+}
+
+FVector FSpatialBuddyTree::GetBlockCenter(int32 Depth, int32 Index) const
+{
+	const float BlockSize = GetBlockSize(Depth);
+	const FVector Coord(SpatialBuddy::Compact(Index >> 0), SpatialBuddy::Compact(Index >> 1), SpatialBuddy::Compact(Index >> 2));
+	return(Location + (Coord + FVector(0.5f)) * BlockSize);
+}
+
+int32 FSpatialBuddyTree::GetNum() const
+{
+	return(Num);
+}
+
+int32 FSpatialBuddyTree::GetDepthNum() const
+{
+	return(Depths);
+}
+
+int32 FSpatialBuddyTree::LocateBlock(int32 Depth, const FVector& Point) const
+{
+	const int32 Max = (1 << Depth) - 1;
+	const FVector Coord = (Point - Location) / GetBlockSize(Depth);
+	return(SpatialBuddy::Interleave(
+		FMath::Clamp(FMath::FloorToInt(Coord.X), 0, Max),
+		FMath::Clamp(FMath::FloorToInt(Coord.Y), 0, Max),
+		FMath::Clamp(FMath::FloorToInt(Coord.Z), 0, Max)));
+}
+
+void FSpatialBuddyTree::SetFree(int32 Depth, int32 Index)
+{
+	FLevel& Level = Levels[Depth];
+	const int32 Word = Index >> 6;
+	if (Level.Free[Word] == 0)
+	{
+		// Word turns non-empty, propagate into the summaries
+		if (Level.Summary[0][Word >> 6] == 0)
+		{
+			Level.Summary[1][Word >> 12] |= uint64(1) << ((Word >> 6) & 63);
+		}
+		Level.Summary[0][Word >> 6] |= uint64(1) << (Word & 63);
+	}
+	Level.Free[Word] |= uint64(1) << (Index & 63);
+	Level.FreeNum++;
+}
+
+void FSpatialBuddyTree::ClearFree(int32 Depth, int32 Word, uint64 Mask)
+{
+	FLevel& Level = Levels[Depth];
+	Level.Free[Word] &= ~Mask;
+	if (Level.Free[Word] == 0)
+	{
+		// Word turns empty, propagate into the summaries
+		Level.Summary[0][Word >> 6] &= ~(uint64(1) << (Word & 63));
+		if (Level.Summary[0][Word >> 6] == 0)
+		{
+			Level.Summary[1][Word >> 12] &= ~(uint64(1) << ((Word >> 6) & 63));
+		}
+	}
+}
+
+int32 FSpatialBuddyTree::TakeFree(int32 Depth)
+{
+	FLevel& Level = Levels[Depth];
+	if (Level.FreeNum == 0)
+	{
+		return(INDEX_NONE);
+	}
+
+	// Top summary is at most 8 words, everything below is one bit scan each
+	for (int32 Top = 0; Top < Level.Summary[1].Num(); Top++)
+	{
+		if (Level.Summary[1][Top])
+		{
+			const int32 Outer = (Top << 6) + FMath::CountTrailingZeros64(Level.Summary[1][Top]);
+			const int32 Word = (Outer << 6) + FMath::CountTrailingZeros64(Level.Summary[0][Outer]);
+			const int32 Bit = FMath::CountTrailingZeros64(Level.Free[Word]);
+			ClearFree(Depth, Word, uint64(1) << Bit);
+			Level.FreeNum--;
+			return((Word << 6) + Bit);
+		}
+	}
+	return(INDEX_NONE);
+}
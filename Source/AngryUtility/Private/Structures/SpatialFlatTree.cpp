@@ -0,0 +1,286 @@
+// Maintained by AngryLizard, netliz.net
+
+#include "Structures/SpatialFlatTree.h"
+
+template<typename VectorType>
+TSpatialFlatTree<VectorType>::TSpatialFlatTree(const VectorType& Location, const VectorType& Size, int32 Slices)
+	: FreeNodes(INDEX_NONE), FreeLinks(INDEX_NONE), NodeNum(0), Slices(Slices)
+{
+	AllocateNode(Location, Size, Dimensions - 1, ESpatialNodeType::Branch);
+}
+
+template<typename VectorType>
+uint8 TSpatialFlatTree<VectorType>::GetNext(uint8 Axis)
+{
+	// Last component first, same as Z, Y, X in 3D
+	return(Axis > 0 ? Axis - 1 : Dimensions - 1);
+}
+
+template<typename VectorType>
+VectorType TSpatialFlatTree<VectorType>::SliceSize(const VectorType& Size, uint8 Axis) const
+{
+	// Slice length
+	const float Length = Size[Axis];
+	const float Section = Length / Slices;
+
+	// Compute cell size
+	VectorType NewSize = Size;
+	NewSize[Axis] = Section;
+	return(NewSize);
+}
+
+template<typename VectorType>
+void TSpatialFlatTree<VectorType>::UpdateSpace(int32 Index)
+{
+	FNode& Node = Nodes[Index];
+
+	// Only update space if full
+	if (Node.Num == Slices)
+	{
+		// Get max of all children
+		Node.Space = VectorType::ZeroVector;
+		for (int32 Slot = 0; Slot < Slices; Slot++)
+		{
+			Node.Space = Nodes[Links[Node.Children + Slot]].Space.ComponentMax(Node.Space);
+		}
+	}
+	else
+	{
+		// Space is size of new slice
+		Node.Space = SliceSize(Node.Size, Node.Axis);
+	}
+}
+
+template<typename VectorType>
+int32 TSpatialFlatTree<VectorType>::AllocateNode(const VectorType& Location, const VectorType& Size, uint8 Axis, ESpatialNodeType Type)
+{
+	int32 Index = FreeNodes;
+	if (Index != INDEX_NONE)
+	{
+		FreeNodes = Nodes[Index].Children;
+	}
+	else
+	{
+		Index = Nodes.AddUninitialized();
+	}
+
+	FNode& Node = Nodes[Index];
+	Node.Location = Location;
+	Node.Size = Size;
+	Node.Space = VectorType::ZeroVector;
+	Node.Children = INDEX_NONE;
+	Node.Num = 0;
+	Node.Axis = Axis;
+	Node.Type = Type;
+
+	if (Type == ESpatialNodeType::Branch)
+	{
+		// Reuse a block of child slots
+		int32 Children = FreeLinks;
+		if (Children != INDEX_NONE)
+		{
+			FreeLinks = Links[Children];
+		}
+		else
+		{
+			Children = Links.AddUninitialized(Slices);
+		}
+
+		for (int32 Slot = 0; Slot < Slices; Slot++)
+		{
+			Links[Children + Slot] = INDEX_NONE;
+		}
+
+		Node.Children = Children;
+		Node.Space = SliceSize(Size, Axis);
+	}
+
+	NodeNum++;
+	return Index;
+}
+
+template<typename VectorType>
+void TSpatialFlatTree<VectorType>::FreeNode(int32 Index)
+{
+	FNode& Node = Nodes[Index];
+	if (Node.Type == ESpatialNodeType::Branch)
+	{
+		Links[Node.Children] = FreeLinks;
+		FreeLinks = Node.Children;
+	}
+
+	Node.Type = ESpatialNodeType::Free;
+	Node.Children = FreeNodes;
+	FreeNodes = Index;
+	NodeNum--;
+}
+
+template<typename VectorType>
+bool TSpatialFlatTree<VectorType>::Insert(const VectorType& Bounds, VectorType& Result)
+{
+	if (!Nodes[RootIndex].HasSpace(Bounds))
+	{
+		return(false);
+	}
+
+	// Branches visited on the way down
+	TArray<int32, TInlineAllocator<64>> Path;
+
+	bool Success = false;
+	int32 Index = RootIndex;
+	while (Index != INDEX_NONE)
+	{
+		if (Nodes[Index].Type == ESpatialNodeType::Leaf)
+		{
+			// Return center as cell location
+			Result = Nodes[Index].Location + Nodes[Index].Size / 2;
+			Success = true;
+			break;
+		}
+		Path.Emplace(Index);
+
+		// Allocate to already existing child
+		const int32 Children = Nodes[Index].Children;
+		int32 Next = INDEX_NONE;
+		for (int32 Slot = 0; Slot < Slices; Slot++)
+		{
+			const int32 Child = Links[Children + Slot];
+			if (Child != INDEX_NONE && Nodes[Child].HasSpace(Bounds))
+			{
+				Next = Child;
+				break;
+			}
+		}
+
+		if (Next == INDEX_NONE)
+		{
+			const FNode& Node = Nodes[Index];
+			const uint8 Axis = Node.Axis;
+
+			// Compute next cell Dimensions
+			const float Length = Node.Size[Axis];
+			const float Section = Length / Slices;
+
+			// Compute cell size and location
+			VectorType NewSize = Node.Size;
+			VectorType NewLocation = Node.Location;
+			const float Offset = Node.Location[Axis];
+
+			// Find empty slot
+			for (int32 Slot = 0; Slot < Slices; Slot++)
+			{
+				if (Links[Children + Slot] == INDEX_NONE)
+				{
+					NewSize[Axis] = Section;
+					NewLocation[Axis] = Offset + Section * Slot;
+
+					// Determine whether cell can further be split
+					const uint8 NextAxis = GetNext(Axis);
+					const VectorType Slice = SliceSize(NewSize, NextAxis);
+					bool bSplit = true;
+					for (int32 Component = 0; Component < Dimensions; Component++)
+					{
+						bSplit &= Bounds[Component] < Slice[Component];
+					}
+
+					// Node may be invalidated from here on
+					Next = AllocateNode(NewLocation, NewSize, NextAxis, bSplit ? ESpatialNodeType::Branch : ESpatialNodeType::Leaf);
+					Links[Children + Slot] = Next;
+					Nodes[Index].Num++;
+					break;
+				}
+			}
+		}
+
+		Index = Next;
+	}
+
+	// Propagate space back up
+	for (int32 Depth = Path.Num() - 1; Depth >= 0; Depth--)
+	{
+		UpdateSpace(Path[Depth]);
+	}
+	return(Success);
+}
+
+template<typename VectorType>
+bool TSpatialFlatTree<VectorType>::Remove(const VectorType& Point)
+{
+	// Nodes and the child slot they are stored in
+	TArray<int32, TInlineAllocator<64>> Path;
+	TArray<int32, TInlineAllocator<64>> Slots;
+
+	int32 Index = RootIndex;
+	Path.Emplace(RootIndex);
+	Slots.Emplace(INDEX_NONE);
+	while (Nodes[Index].Type == ESpatialNodeType::Branch)
+	{
+		const int32 Children = Nodes[Index].Children;
+		int32 Next = INDEX_NONE;
+		for (int32 Slot = 0; Slot < Slices; Slot++)
+		{
+			const int32 Child = Links[Children + Slot];
+			if (Child != INDEX_NONE && Nodes[Child].IsInside(Point))
+			{
+				Next = Child;
+				Path.Emplace(Child);
+				Slots.Emplace(Children + Slot);
+				break;
+			}
+		}
+
+		if (Next == INDEX_NONE)
+		{
+			break;
+		}
+		Index = Next;
+	}
+
+	// Leaves always get removed, branches once they are empty
+	bool bRemove = true;
+	if (Nodes[Index].Type == ESpatialNodeType::Branch)
+	{
+		UpdateSpace(Index);
+		bRemove = Nodes[Index].Num == 0;
+	}
+
+	for (int32 Depth = Path.Num() - 1; Depth > 0; Depth--)
+	{
+		const int32 Parent = Path[Depth - 1];
+		if (bRemove)
+		{
+			FreeNode(Path[Depth]);
+			Links[Slots[Depth]] = INDEX_NONE;
+			Nodes[Parent].Num--;
+		}
+
+		UpdateSpace(Parent);
+		bRemove = Nodes[Parent].Num == 0;
+	}
+
+	return(Nodes[RootIndex].Num == 0);
+}
+
+template<typename VectorType>
+void TSpatialFlatTree<VectorType>::Reset()
+{
+	const VectorType Location = Nodes[RootIndex].Location;
+	const VectorType Size = Nodes[RootIndex].Size;
+
+	Nodes.Reset();
+	Links.Reset();
+	FreeNodes = INDEX_NONE;
+	FreeLinks = INDEX_NONE;
+	NodeNum = 0;
+
+	AllocateNode(Location, Size, Dimensions - 1, ESpatialNodeType::Branch);
+}
+
+template<typename VectorType>
+int32 TSpatialFlatTree<VectorType>::GetNodeNum() const
+{
+	return NodeNum;
+}
+
+template class ANGRYUTILITY_API TSpatialFlatTree<FVector>;
+template class ANGRYUTILITY_API TSpatialFlatTree<FVector2D>;
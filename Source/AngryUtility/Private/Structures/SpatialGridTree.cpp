@@ -0,0 +1,312 @@
+// Maintained by AngryLizard, netliz.net
+
+#include "Structures/SpatialGridTree.h"
+
+FSpatialGridTree::FSpatialGridTree(const FIntVector& Location, const FIntVector& Size, int32 Slices)
+	: FreeNodes(INDEX_NONE), FreeLanes(INDEX_NONE), NodeNum(0), Slices(Slices), LaneNum(Slices > 4 ? 8 : 4), SlotMask((1u << Slices) - 1)
+{
+	check(Slices >= 2 && Slices <= FSpatialGridLanes::MaxSlices);
+	AllocateNode(Location, Size, 2, ESpatialNodeType::Branch);
+}
+
+uint8 FSpatialGridTree::GetNext(uint8 Axis)
+{
+	// Z, Y, X, same as FSpatialRoot
+	return(Axis > 0 ? Axis - 1 : 2);
+}
+
+int32 FSpatialGridTree::GetSlotOffset(int32 Length, int32 Slot) const
+{
+	return(int32(int64(Length) * Slot / Slices));
+}
+
+int32 FSpatialGridTree::GetSlotAt(int32 Length, int32 Offset) const
+{
+	// Last slot whose start is at or before the offset
+	return(int32((int64(Offset + 1) * Slices - 1) / Length));
+}
+
+FIntVector FSpatialGridTree::GetSlotSize(const FSpatialGridNode& Node, int32 Slot) const
+{
+	const int32 Length = Node.Size[Node.Axis];
+	FIntVector Size = Node.Size;
+	Size[Node.Axis] = GetSlotOffset(Length, Slot + 1) - GetSlotOffset(Length, Slot);
+	return(Size);
+}
+
+uint32 FSpatialGridTree::GetFitMask(const FSpatialGridLanes& Block, const FIntVector& Bounds) const
+{
+	const VectorRegister4Int X = VectorIntSet1(Bounds.X);
+	const VectorRegister4Int Y = VectorIntSet1(Bounds.Y);
+	const VectorRegister4Int Z = VectorIntSet1(Bounds.Z);
+
+	uint32 Small = 0;
+	for (int32 Lane = 0; Lane < LaneNum; Lane += 4)
+	{
+		// A slot is too small if any axis is
+		const VectorRegister4Int Compare = VectorIntOr(VectorIntOr(
+			VectorIntCompareGT(X, VectorIntLoad(&Block.Space[0][Lane])),
+			VectorIntCompareGT(Y, VectorIntLoad(&Block.Space[1][Lane]))),
+			VectorIntCompareGT(Z, VectorIntLoad(&Block.Space[2][Lane])));
+		Small |= uint32(VectorMaskBits(VectorCastIntToFloat(Compare))) << Lane;
+	}
+	return(~Small & SlotMask);
+}
+
+FIntVector FSpatialGridTree::GetSpace(const FSpatialGridLanes& Block) const
+{
+	FIntVector Space;
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		VectorRegister4Int Lane = VectorIntLoad(&Block.Space[Axis][0]);
+		if (LaneNum > 4)
+		{
+			Lane = VectorIntMax(Lane, VectorIntLoad(&Block.Space[Axis][4]));
+		}
+
+		int32 Max[4];
+		VectorIntStore(Lane, Max);
+		Space[Axis] = FMath::Max(FMath::Max(Max[0], Max[1]), FMath::Max(Max[2], Max[3]));
+	}
+	return(Space);
+}
+
+bool FSpatialGridTree::SetSlotSpace(FSpatialGridLanes& Block, int32 Slot, const FIntVector& Space)
+{
+	if (Block.Space[0][Slot] == Space.X && Block.Space[1][Slot] == Space.Y && Block.Space[2][Slot] == Space.Z)
+	{
+		return(false);
+	}
+
+	Block.Space[0][Slot] = Space.X;
+	Block.Space[1][Slot] = Space.Y;
+	Block.Space[2][Slot] = Space.Z;
+	return(true);
+}
+
+int32 FSpatialGridTree::AllocateNode(const FIntVector& Location, const FIntVector& Size, uint8 Axis, ESpatialNodeType Type)
+{
+	int32 Index = FreeNodes;
+	if (Index != INDEX_NONE)
+	{
+		FreeNodes = Nodes[Index].Lanes;
+	}
+	else
+	{
+		Index = Nodes.AddUninitialized();
+	}
+
+	FSpatialGridNode& Node = Nodes[Index];
+	Node.Location = Location;
+	Node.Size = Size;
+	Node.Lanes = INDEX_NONE;
+	Node.Num = 0;
+	Node.Axis = Axis;
+	Node.Type = Type;
+
+	if (Type == ESpatialNodeType::Branch)
+	{
+		// Reuse a lane block
+		int32 Block = FreeLanes;
+		if (Block != INDEX_NONE)
+		{
+			FreeLanes = Lanes[Block].Children[0];
+		}
+		else
+		{
+			Block = Lanes.AddUninitialized();
+		}
+
+		// Every slot offers its full size, unused lanes never fit
+		FSpatialGridLanes& Slots = Lanes[Block];
+		int32 Offset = 0;
+		for (int32 Slot = 0; Slot < FSpatialGridLanes::MaxSlices; Slot++)
+		{
+			FIntVector Space = FIntVector::ZeroValue;
+			if (Slot < Slices)
+			{
+				const int32 Next = GetSlotOffset(Size[Axis], Slot + 1);
+				Space = Size;
+				Space[Axis] = Next - Offset;
+				Offset = Next;
+			}
+
+			Slots.Space[0][Slot] = Space.X;
+			Slots.Space[1][Slot] = Space.Y;
+			Slots.Space[2][Slot] = Space.Z;
+			Slots.Children[Slot] = INDEX_NONE;
+		}
+		Slots.Occupied = 0;
+
+		Node.Lanes = Block;
+	}
+
+	NodeNum++;
+	return Index;
+}
+
+void FSpatialGridTree::FreeNode(int32 Index)
+{
+	FSpatialGridNode& Node = Nodes[Index];
+	if (Node.Type == ESpatialNodeType::Branch)
+	{
+		Lanes[Node.Lanes].Children[0] = FreeLanes;
+		FreeLanes = Node.Lanes;
+	}
+
+	Node.Type = ESpatialNodeType::Free;
+	Node.Lanes = FreeNodes;
+	FreeNodes = Index;
+	NodeNum--;
+}
+
+bool FSpatialGridTree::Insert(const FIntVector& Bounds, FIntVector& Result)
+{
+	// Empty boxes still take a cell
+	const FIntVector Cells(FMath::Max(Bounds.X, 1), FMath::Max(Bounds.Y, 1), FMath::Max(Bounds.Z, 1));
+
+	// Branches visited on the way down and the slot taken in each
+	TArray<int32, TInlineAllocator<64>> Path;
+	TArray<int32, TInlineAllocator<64>> Slots;
+
+	int32 Index = RootIndex;
+	while (true)
+	{
+		const FSpatialGridLanes& Block = Lanes[Nodes[Index].Lanes];
+		const uint32 Fit = GetFitMask(Block, Cells);
+		if (Fit == 0)
+		{
+			// Space is a max per axis, so a child can still turn out too small
+			return(false);
+		}
+
+		// Allocate to already existing child before opening a new slot
+		const uint32 Existing = Fit & Block.Occupied;
+		const int32 Slot = FMath::CountTrailingZeros(Existing ? Existing : Fit);
+		Path.Emplace(Index);
+		Slots.Emplace(Slot);
+
+		if (Existing)
+		{
+			Index = Block.Children[Slot];
+			continue;
+		}
+
+		const FSpatialGridNode& Node = Nodes[Index];
+		const uint8 Axis = Node.Axis;
+		FIntVector NewLocation = Node.Location;
+		NewLocation[Axis] += GetSlotOffset(Node.Size[Axis], Slot);
+		const FIntVector NewSize = GetSlotSize(Node, Slot);
+
+		// Split further if the smallest slot on the next axis still fits
+		const uint8 NextAxis = GetNext(Axis);
+		const bool bSplit = Cells[NextAxis] <= NewSize[NextAxis] / Slices;
+
+		// Node and block may be invalidated from here on
+		const int32 Child = AllocateNode(NewLocation, NewSize, NextAxis, bSplit ? ESpatialNodeType::Branch : ESpatialNodeType::Leaf);
+		FSpatialGridLanes& Parent = Lanes[Nodes[Index].Lanes];
+		Parent.Children[Slot] = Child;
+		Parent.Occupied |= 1u << Slot;
+		Nodes[Index].Num++;
+
+		if (!bSplit)
+		{
+			Result = NewLocation;
+			break;
+		}
+		Index = Child;
+	}
+
+	// Propagate space back up, leaves have none
+	FIntVector Space = FIntVector::ZeroValue;
+	for (int32 Depth = Path.Num() - 1; Depth >= 0; Depth--)
+	{
+		if (!SetSlotSpace(Lanes[Nodes[Path[Depth]].Lanes], Slots[Depth], Space))
+		{
+			break;
+		}
+		Space = GetSpace(Lanes[Nodes[Path[Depth]].Lanes]);
+	}
+	return(true);
+}
+
+bool FSpatialGridTree::Remove(const FIntVector& Cell)
+{
+	const FSpatialGridNode& Root = Nodes[RootIndex];
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		if (Cell[Axis] < Root.Location[Axis] || Root.Location[Axis] + Root.Size[Axis] <= Cell[Axis])
+		{
+			return(Root.Num == 0);
+		}
+	}
+
+	// Branches visited on the way down and the slot taken in each
+	TArray<int32, TInlineAllocator<64>> Path;
+	TArray<int32, TInlineAllocator<64>> Slots;
+
+	// Children only differ from their parent along its axis, so one lookup per level is enough
+	int32 Index = RootIndex;
+	while (Nodes[Index].Type == ESpatialNodeType::Branch)
+	{
+		const FSpatialGridNode& Node = Nodes[Index];
+		const int32 Slot = GetSlotAt(Node.Size[Node.Axis], Cell[Node.Axis] - Node.Location[Node.Axis]);
+		const int32 Child = Lanes[Node.Lanes].Children[Slot];
+		if (Child == INDEX_NONE)
+		{
+			return(Nodes[RootIndex].Num == 0);
+		}
+
+		Path.Emplace(Index);
+		Slots.Emplace(Slot);
+		Index = Child;
+	}
+
+	// Leaves always get removed, branches once they are empty
+	bool bRemove = true;
+	FIntVector Space = FIntVector::ZeroValue;
+	for (int32 Depth = Path.Num() - 1; Depth >= 0; Depth--)
+	{
+		const int32 Parent = Path[Depth];
+		const int32 Slot = Slots[Depth];
+		FSpatialGridLanes& Block = Lanes[Nodes[Parent].Lanes];
+		if (bRemove)
+		{
+			FreeNode(Block.Children[Slot]);
+			Block.Children[Slot] = INDEX_NONE;
+			Block.Occupied &= ~(1u << Slot);
+			Nodes[Parent].Num--;
+
+			// Empty slots offer their full size again
+			Space = GetSlotSize(Nodes[Parent], Slot);
+		}
+
+		if (!SetSlotSpace(Block, Slot, Space) && !bRemove)
+		{
+			break;
+		}
+		Space = GetSpace(Block);
+		bRemove = Nodes[Parent].Num == 0;
+	}
+
+	return(Nodes[RootIndex].Num == 0);
+}
+
+void FSpatialGridTree::Reset()
+{
+	const FIntVector Location = Nodes[RootIndex].Location;
+	const FIntVector Size = Nodes[RootIndex].Size;
+
+	Nodes.Reset();
+	Lanes.Reset();
+	FreeNodes = INDEX_NONE;
+	FreeLanes = INDEX_NONE;
+	NodeNum = 0;
+
+	AllocateNode(Location, Size, 2, ESpatialNodeType::Branch);
+}
+
+int32 FSpatialGridTree::GetNodeNum() const
+{
+	return NodeNum;
+}
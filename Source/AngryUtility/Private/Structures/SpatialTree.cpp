@@ -1,9 +1,68 @@
 // Maintained by AngryLizard, netliz.net
 
 #include "Structures/SpatialTree.h"
+#include "Misc/ScopeLock.h"
+#include "Stats/Stats.h"
+
+DECLARE_STATS_GROUP(TEXT("SpatialTree"), STATGROUP_SpatialTree, STATCAT_Advanced);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Leaves"), STAT_SpatialTreeLeaves, STATGROUP_SpatialTree);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Branches"), STAT_SpatialTreeBranches, STATGROUP_SpatialTree);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Depth"), STAT_SpatialTreeDepth, STATGROUP_SpatialTree);
+DECLARE_MEMORY_STAT(TEXT("Arena"), STAT_SpatialTreeBytes, STATGROUP_SpatialTree);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Occupied %"), STAT_SpatialTreeOccupied, STATGROUP_SpatialTree);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Largest free cube"), STAT_SpatialTreeLargestFree, STATGROUP_SpatialTree);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Failed inserts"), STAT_SpatialTreeFailedInserts, STATGROUP_SpatialTree);
+
+bool FSpatialHandle::IsValid() const
+{
+	return Depth > 0 && Depth != Overflow;
+}
+
+void FSpatialHandle::Push(int32 Slot, int32 Bits)
+{
+	if (Depth == Overflow)
+	{
+		return;
+	}
+
+	if ((Depth + 1) * Bits > 64)
+	{
+		Depth = Overflow;
+		return;
+	}
+
+	Path |= uint64(Slot) << (Depth * Bits);
+	Depth++;
+}
+
+int32 FSpatialHandle::GetSlot(int32 Level, int32 Bits) const
+{
+	const uint64 Mask = (uint64(1) << Bits) - 1;
+	return int32((Path >> (Level * Bits)) & Mask);
+}
+
+void FSpatialHandle::Lift(int32 Levels, int32 Bits)
+{
+	if (Depth == Overflow || Levels <= 0)
+	{
+		return;
+	}
+
+	if ((Depth + Levels) * Bits > 64)
+	{
+		Depth = Overflow;
+		return;
+	}
+
+	// First slot is zero, so only the path moves
+	Path <<= Levels * Bits;
+	Depth += Levels;
+	Growth += Levels;
+}
+
 
 FSpatialTree::FSpatialTree(const FVector& Location, const FVector& Size)
-	: Location(Location), Size(Size), Space(FVector::ZeroVector)
+	: Location(Location), Size(Size), Space(FVector::ZeroVector), bLocked(false), bRetired(false), Epoch(0)
 {
 }
 
@@ -11,6 +70,58 @@ FSpatialTree::~FSpatialTree()
 {
 }
 
+void FSpatialTree::Lock()
+{
+	while (bLocked.exchange(true, std::memory_order_acquire))
+	{
+		// Wait on a plain read so we don't keep stealing the cache line
+		while (bLocked.load(std::memory_order_relaxed))
+		{
+			FPlatformProcess::YieldThread();
+		}
+	}
+}
+
+void FSpatialTree::Unlock()
+{
+	bLocked.store(false, std::memory_order_release);
+}
+
+void FSpatialTree::MarkRetired()
+{
+	bRetired = true;
+}
+
+uint32 FSpatialTree::GetEpoch() const
+{
+	return Epoch;
+}
+
+void FSpatialTree::SetEpoch(uint32 NewEpoch)
+{
+	Epoch = NewEpoch;
+}
+
+const FVector& FSpatialTree::GetLocation() const
+{
+	return Location;
+}
+
+const FVector& FSpatialTree::GetSize() const
+{
+	return Size;
+}
+
+const FVector& FSpatialTree::GetSpace() const
+{
+	return Space;
+}
+
+FBox FSpatialTree::GetBox() const
+{
+	return FBox(Location, Location + Size);
+}
+
 bool FSpatialTree::IsInside(const FVector& Point) const
 {
 	return(Location.X <= Point.X && Point.X < Location.X + Size.X &&
@@ -41,18 +152,48 @@ FSpatialLeaf::~FSpatialLeaf()
 {
 }
 
-bool FSpatialLeaf::Insert(const FVector& Bounds, FVector& Result)
+FSpatialLeaf* FSpatialLeaf::Create(FSpatialRoot& Root, const FVector& Location, const FVector& Size)
+{
+	FSpatialLeaf* Leaf = Root.Arena.New<FSpatialLeaf>(sizeof(FSpatialLeaf), Location, Size);
+	Root.Track(Leaf);
+	return Leaf;
+}
+
+bool FSpatialLeaf::IsLeaf() const
+{
+	return(true);
+}
+
+bool FSpatialLeaf::Insert(FSpatialRoot& Root, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle)
 {
 	// Return min corner as cell location
 	Result = Location + Size / 2;
 	return(true);
 }
 
-bool FSpatialLeaf::Remove(const FVector& Point)
+bool FSpatialLeaf::InsertConcurrent(FSpatialRoot& Root, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle)
+{
+	Result = Location + Size / 2;
+	Unlock();
+	return(true);
+}
+
+void FSpatialLeaf::InsertBatch(FSpatialRoot& Root, TArray<FSpatialBatchGroup*>& Pending, TArray<FVector>& OutLocations)
+{
+	// Occupied cells never have room
+}
+
+bool FSpatialLeaf::Remove(FSpatialRoot& Root, const FVector& Point)
 {
 	return(true);
 }
 
+bool FSpatialLeaf::Remove(FSpatialRoot& Root, const FSpatialHandle& Handle, int32 Level)
+{
+	// Handle has to end exactly here
+	return(Level == Handle.Depth);
+}
+
 void FSpatialLeaf::ForEach(std::function<void(const FVector&, const FVector&, bool)> Func)
 {
 	const FVector Extend = Size / 2;
@@ -60,28 +201,78 @@ void FSpatialLeaf::ForEach(std::function<void(const FVector&, const FVector&, bo
 	Func(Center, Extend, true);
 }
 
+void FSpatialLeaf::Release(FSpatialRoot& Root)
+{
+	Root.Arena.Delete(this, sizeof(FSpatialLeaf));
+}
+
 
-FSpatialBranch::FSpatialBranch(const FVector& Location, const FVector& Size, EAxis::Type Axis, int32 Slices)
-	: FSpatialTree(Location, Size), Num(0), Slices(Slices), Axis(Axis)
+FSpatialBranch::FSpatialBranch(const FVector& Location, const FVector& Size, EAxis::Type Axis, int32 Slices, int32 Depth)
+	: FSpatialTree(Location, Size), Children(reinterpret_cast<FSpatialTree**>(this + 1)), Num(0), Slices(Slices), Axis(Axis), Depth(Depth), FreeDepths(0), Reservation(INDEX_NONE)
 {
-	Children.SetNumZeroed(Slices);
-	Space = SliceSize();
+	FMemory::Memzero(Children, sizeof(FSpatialTree*) * Slices);
+	GatherSpace(false);
 }
 
 FSpatialBranch::~FSpatialBranch()
 {
-	// Free all children
-	for (FSpatialTree*& Child : Children)
-	{
-		if (Child)
-		{
-			delete(Child);
-			Child = nullptr;
-		}
-	}
+	// Children are owned by the arena
+}
+
+FSpatialBranch* FSpatialBranch::Create(FSpatialRoot& Root, const FVector& Location, const FVector& Size, EAxis::Type Axis, int32 Slices, int32 Depth)
+{
+	FSpatialBranch* Branch = Root.Arena.New<FSpatialBranch>(GetAllocSize(Slices), Location, Size, Axis, Slices, Depth);
+	Root.Track(Branch);
+	return Branch;
+}
+
+FSpatialBranch* FSpatialBranch::Clone(FSpatialRoot& Root) const
+{
+	FSpatialBranch* Branch = Create(Root, Location, Size, Axis, Slices, Depth);
+	FMemory::Memcpy(Branch->Children, Children, sizeof(FSpatialTree*) * Slices);
+	Branch->Num = Num;
+	Branch->Space = Space;
+	Branch->FreeDepths = FreeDepths;
+	Branch->Reservation = Reservation;
+	return Branch;
+}
+
+SIZE_T FSpatialBranch::GetAllocSize(int32 Slices)
+{
+	return sizeof(FSpatialBranch) + sizeof(FSpatialTree*) * Slices;
+}
+
+TArrayView<FSpatialTree*> FSpatialBranch::GetChildren() const
+{
+	return TArrayView<FSpatialTree*>(Children, Slices);
+}
+
+int32 FSpatialBranch::GetNum() const
+{
+	return Num;
+}
+
+EAxis::Type FSpatialBranch::GetAxis() const
+{
+	return Axis;
+}
+
+int32 FSpatialBranch::GetDepth() const
+{
+	return Depth;
+}
+
+uint64 FSpatialBranch::GetFreeDepths() const
+{
+	return FreeDepths;
 }
 
 EAxis::Type FSpatialBranch::GetNext() const
+{
+	return GetNext(Axis);
+}
+
+EAxis::Type FSpatialBranch::GetNext(EAxis::Type Axis)
 {
 	switch (Axis)
 	{
@@ -92,7 +283,12 @@ EAxis::Type FSpatialBranch::GetNext() const
 	}
 }
 
-FVector FSpatialBranch::SliceSize()
+FVector FSpatialBranch::SliceSize() const
+{
+	return SliceSize(Size, Axis, Slices);
+}
+
+FVector FSpatialBranch::SliceSize(const FVector& Size, EAxis::Type Axis, int32 Slices)
 {
 	// Slice length
 	const float Length = Size.GetComponentForAxis(Axis);
@@ -106,137 +302,1920 @@ FVector FSpatialBranch::SliceSize()
 
 void FSpatialBranch::UpdateSpace()
 {
+	GatherSpace(false);
+}
+
+void FSpatialBranch::UpdateSpaceConcurrent()
+{
+	// Children may be written by threads further down
+	GatherSpace(true);
+}
+
+void FSpatialBranch::GatherSpace(bool bLockChildren)
+{
+	// Own empty slots
+	FreeDepths = (Num < Slices && Depth < MaxDepth) ? (uint64(1) << Depth) : 0;
+
 	// Only update space if full
 	if (Num == Slices)
 	{
 		// Reset space
 		Space = FVector::ZeroVector;
-
-		// Get max of all children
-		for (FSpatialTree* Child : Children)
-		{
-			Space = Child->GetMax(Space);
-		}
 	}
 	else
 	{
 		// Space is size of new slice
 		Space = SliceSize();
 	}
+
+	for (FSpatialTree* Child : GetChildren())
+	{
+		if (!Child)
+		{
+			continue;
+		}
+
+		if (bLockChildren)
+		{
+			Child->Lock();
+		}
+
+		// Get max of all children
+		if (Num == Slices)
+		{
+			Space = Child->GetMax(Space);
+		}
+
+		if (!Child->IsLeaf())
+		{
+			FreeDepths |= static_cast<FSpatialBranch*>(Child)->FreeDepths;
+		}
+
+		if (bLockChildren)
+		{
+			Child->Unlock();
+		}
+	}
 }
 
-bool FSpatialBranch::Insert(FSpatialTree* Child, const FVector& Bounds, FVector& Result)
+bool FSpatialBranch::Insert(FSpatialRoot& Root, int32 Slot, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle)
 {
-	bool Success = Child->Insert(Bounds, Result);
+	Children[Slot] = Root.Touch(Children[Slot]);
+	Handle.Push(Slot, Root.PathBits);
+	bool Success = Children[Slot]->Insert(Root, Bounds, Result, Handle);
 	UpdateSpace();
 	return(Success);
 }
 
-bool FSpatialBranch::Insert(const FVector& Bounds, FVector& Result)
+void FSpatialBranch::GetSlotCell(int32 Slot, FVector& OutLocation, FVector& OutSize) const
 {
-	// Allocate to already existing child
-	for (FSpatialTree* Child : Children)
-	{
-		// Check if there is space and insert
-		if (Child && Child->HasSpace(Bounds))
-		{
-			return(Insert(Child, Bounds, Result));
-		}
-	}
-
 	// Compute next cell Dimensions
-	const float Bound = Bounds.GetComponentForAxis(Axis);
 	const float Length = Size.GetComponentForAxis(Axis);
 	const float Section = Length / Slices;
 
 	// Compute cell size
-	FVector NewSize = Size;
+	OutSize = Size;
+	OutSize.SetComponentForAxis(Axis, Section);
 
 	// Compute cell location
-	FVector NewLocation = Location;
+	OutLocation = Location;
 	const float Offset = Location.GetComponentForAxis(Axis);
+	OutLocation.SetComponentForAxis(Axis, Offset + Section * Slot);
+}
 
-	// Find empty slot
-	for (int i = 0; i < Slices; i++)
-	{
-		if (!Children[i])
-		{
-			// Transform new dimensions
-			NewSize.SetComponentForAxis(Axis, Section);
-			NewLocation.SetComponentForAxis(Axis, Offset + Section * i);
+FSpatialTree* FSpatialBranch::CreateChild(FSpatialRoot& Root, int32 Slot, const FVector& Bounds, bool& bIsLeaf)
+{
+	FVector NewLocation, NewSize;
+	GetSlotCell(Slot, NewLocation, NewSize);
 
-			// Create branch
-			EAxis::Type Next = GetNext();
-			FSpatialTree* Child = new FSpatialBranch(NewLocation, NewSize, Next, Slices);
+	// Determine whether cell can further be split before allocating anything,
+	// an empty branch would have exactly one slice of space. Branches stop at the depth the counters cover.
+	const FVector Slice = SliceSize(NewSize, GetNext(), Slices);
+	bIsLeaf = Depth + 1 >= MaxDepth || !(Bounds.X < Slice.X && Bounds.Y < Slice.Y && Bounds.Z < Slice.Z);
+	return(CreateChild(Root, Slot, bIsLeaf));
+}
 
-			// Determine whether cell can further be split
-			if (!Child->HasSpace(Bounds))
-			{
-				// Create leaf instead
-				delete(Child);
-				Child = new FSpatialLeaf(NewLocation, NewSize);
-			}
+FSpatialTree* FSpatialBranch::CreateChild(FSpatialRoot& Root, int32 Slot, bool bIsLeaf)
+{
+	FVector NewLocation, NewSize;
+	GetSlotCell(Slot, NewLocation, NewSize);
 
-			Num++;
-			Children[i] = Child;
-			return(Insert(Child, Bounds, Result));
-		}
+	check(bIsLeaf || Depth + 1 < MaxDepth);
+
+	FSpatialTree* Child = nullptr;
+	if (bIsLeaf)
+	{
+		Child = FSpatialLeaf::Create(Root, NewLocation, NewSize);
+	}
+	else
+	{
+		Child = FSpatialBranch::Create(Root, NewLocation, NewSize, GetNext(), Slices, Depth + 1);
 	}
 
-	return(false);
+	Num++;
+	Children[Slot] = Child;
+	Root.CountNode(Child, Depth + 1, 1);
+	return(Child);
 }
 
-bool FSpatialBranch::Remove(const FVector& Point)
+void FSpatialBranch::Deepen()
 {
-	// Allocate to already existing child
-	for (FSpatialTree*& Child : Children)
+	Depth++;
+	FreeDepths <<= 1;
+	for (FSpatialTree* Child : GetChildren())
 	{
-		// Check if point is inside child
-		if (Child && Child->IsInside(Point) && Child->Remove(Point))
+		if (Child && !Child->IsLeaf())
 		{
-			// Remove child
-			delete(Child);
-			Child = nullptr;
-			Num--;
+			static_cast<FSpatialBranch*>(Child)->Deepen();
 		}
 	}
+}
 
-	// Delete if empty
-	return(Num == 0);
+void FSpatialBranch::Adopt(int32 Slot, FSpatialTree* Child)
+{
+	check(!Children[Slot]);
+	Children[Slot] = Child;
+	Num++;
+	UpdateSpace();
 }
 
-void FSpatialBranch::ForEach(std::function<void(const FVector&, const FVector&, bool)> Func)
+FSpatialBranch* FSpatialBranch::InsertBranchAtDepth(FSpatialRoot& Root, int32 BranchDepth, FSpatialHandle& Handle)
 {
-	// Call locally
-	const FVector Extend = Size / 2;
-	const FVector Center = Location + Extend;
-	Func(Center, Extend, false);
+	if (BranchDepth <= Depth || BranchDepth >= MaxDepth)
+	{
+		return(nullptr);
+	}
 
-	// Call for every child
-	for (FSpatialTree* Child : Children)
+	// Free slots above the new branch's depth can hold it, existing branches on that depth are taken
+	const uint64 Mask = (uint64(1) << BranchDepth) - 1;
+	for (int32 Slot = 0; Slot < Slices; Slot++)
 	{
-		if (Child)
+		FSpatialTree* Child = Children[Slot];
+		if (!Child)
 		{
-			Child->ForEach(Func);
+			Child = CreateChild(Root, Slot, false);
+		}
+		else if (Child->IsLeaf() || !(static_cast<FSpatialBranch*>(Child)->FreeDepths & Mask))
+		{
+			continue;
+		}
+
+		Handle.Push(Slot, Root.PathBits);
+		FSpatialBranch* Branch = static_cast<FSpatialBranch*>(Child);
+		if (Depth + 1 < BranchDepth)
+		{
+			Branch = Branch->InsertBranchAtDepth(Root, BranchDepth, Handle);
 		}
+		UpdateSpace();
+		return(Branch);
 	}
+
+	return(nullptr);
 }
 
+void FSpatialBranch::UpdateSpaceAt(const FVector& Point)
+{
+	for (FSpatialTree* Child : GetChildren())
+	{
+		if (Child && !Child->IsLeaf() && Child->IsInside(Point))
+		{
+			static_cast<FSpatialBranch*>(Child)->UpdateSpaceAt(Point);
+			break;
+		}
+	}
+	UpdateSpace();
+}
 
-FSpatialRoot::FSpatialRoot(const FVector& Location, const FVector& Size, int32 Slices)
-	: FSpatialBranch(Location, Size, EAxis::Z, Slices)
+int32 FSpatialBranch::GetReservation() const
 {
+	return Reservation;
 }
 
-FSpatialRoot::~FSpatialRoot()
+void FSpatialBranch::SetReservation(int32 NewReservation)
 {
+	Reservation = NewReservation;
 }
 
-bool FSpatialRoot::Insert(const FVector& Bounds, FVector& Result)
+bool FSpatialBranch::IsLeaf() const
+{
+	return(false);
+}
+
+bool FSpatialBranch::Insert(FSpatialRoot& Root, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle)
+{
+	if (Root.Placement == ESpatialPlacement::BestFit)
+	{
+		return(InsertBestFit(Root, Bounds, Root.GetFitDepth(Bounds), Result, Handle));
+	}
+
+	// Allocate to already existing child
+	for (int i = 0; i < Slices; i++)
+	{
+		// Check if there is space and insert
+		if (Children[i] && Children[i]->HasSpace(Bounds))
+		{
+			return(Insert(Root, i, Bounds, Result, Handle));
+		}
+	}
+
+	// Find empty slot
+	for (int i = 0; i < Slices; i++)
+	{
+		if (!Children[i])
+		{
+			bool bIsLeaf;
+			CreateChild(Root, i, Bounds, bIsLeaf);
+			return(Insert(Root, i, Bounds, Result, Handle));
+		}
+	}
+
+	return(false);
+}
+
+bool FSpatialBranch::InsertAtDepth(FSpatialRoot& Root, int32 LeafDepth, FVector& Result, FSpatialHandle& Handle)
 {
-	if (HasSpace(Bounds))
+	if (LeafDepth < Depth || LeafDepth >= MaxDepth)
 	{
-		return(FSpatialBranch::Insert(Bounds, Result));
+		return(false);
+	}
+
+	// Any free slot down to the leaf's branch depth will do, deeper ones are too small
+	const uint64 Mask = (uint64(1) << (LeafDepth + 1)) - 1;
+	for (int32 Slot = 0; Slot < Slices; Slot++)
+	{
+		FSpatialTree* Child = Children[Slot];
+		if (!Child)
+		{
+			Child = CreateChild(Root, Slot, Depth == LeafDepth);
+		}
+		else if (Child->IsLeaf() || !(static_cast<FSpatialBranch*>(Child)->FreeDepths & Mask))
+		{
+			continue;
+		}
+
+		Handle.Push(Slot, Root.PathBits);
+		const bool Success = Child->IsLeaf() ?
+			Child->Insert(Root, FVector::ZeroVector, Result, Handle) :
+			static_cast<FSpatialBranch*>(Child)->InsertAtDepth(Root, LeafDepth, Result, Handle);
+		UpdateSpace();
+		return(Success);
 	}
+
 	return(false);
-}
\ No newline at end of file
+}
+
+bool FSpatialBranch::InsertBestFit(FSpatialRoot& Root, const FVector& Bounds, int32 FitDepth, FVector& Result, FSpatialHandle& Handle)
+{
+	// Free cells shrink with depth, so the deepest available one that fits is the tightest
+	if (FitDepth < Depth)
+	{
+		return(false);
+	}
+
+	const uint64 Mask = FitDepth >= MaxDepth - 1 ? MAX_uint64 : ((uint64(1) << (FitDepth + 1)) - 1);
+	const uint64 Fitting = FreeDepths & Mask;
+	if (Fitting == 0)
+	{
+		return(false);
+	}
+
+	const int32 Best = FMath::FloorLog2_64(Fitting);
+	for (int32 Slot = 0; Slot < Slices; Slot++)
+	{
+		FSpatialTree* Child = Children[Slot];
+		if (Best == Depth && !Child)
+		{
+			bool bIsLeaf;
+			Child = CreateChild(Root, Slot, Bounds, bIsLeaf);
+		}
+		else if (!(Best > Depth && Child && !Child->IsLeaf() && (static_cast<FSpatialBranch*>(Child)->FreeDepths & (uint64(1) << Best))))
+		{
+			continue;
+		}
+
+		Child = Root.Touch(Child);
+		Children[Slot] = Child;
+		Handle.Push(Slot, Root.PathBits);
+		const bool Success = Child->IsLeaf() ?
+			Child->Insert(Root, Bounds, Result, Handle) :
+			static_cast<FSpatialBranch*>(Child)->InsertBestFit(Root, Bounds, FitDepth, Result, Handle);
+		UpdateSpace();
+		return(Success);
+	}
+
+	return(false);
+}
+
+bool FSpatialBranch::InsertConcurrent(FSpatialRoot& Root, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle)
+{
+	// Allocate to already existing child
+	for (int32 Slot = 0; Slot < Slices; Slot++)
+	{
+		FSpatialTree* Child = Children[Slot];
+		if (!Child)
+		{
+			continue;
+		}
+
+		// Space has to be checked under the child's lock, hand over once it fits
+		Child->Lock();
+		if (!Child->HasSpace(Bounds))
+		{
+			Child->Unlock();
+			continue;
+		}
+		Unlock();
+
+		const FSpatialHandle Prefix = Handle;
+		Handle.Push(Slot, Root.PathBits);
+		const bool Success = Child->InsertConcurrent(Root, Bounds, Result, Handle);
+
+		// Somebody else might have filled the child in the meantime, try the next one
+		Lock();
+		if (bRetired)
+		{
+			// Only empty branches get retired, so this insert must have failed
+			Unlock();
+			return(false);
+		}
+
+		UpdateSpaceConcurrent();
+		if (Success)
+		{
+			Unlock();
+			return(true);
+		}
+		Handle = Prefix;
+	}
+
+	// Find empty slot
+	for (int32 Slot = 0; Slot < Slices; Slot++)
+	{
+		if (!Children[Slot])
+		{
+			// Child is new so nobody else can hold it yet
+			bool bIsLeaf;
+			FSpatialTree* Child = CreateChild(Root, Slot, Bounds, bIsLeaf);
+			Child->Lock();
+			Unlock();
+
+			Handle.Push(Slot, Root.PathBits);
+			const bool Success = Child->InsertConcurrent(Root, Bounds, Result, Handle);
+
+			Lock();
+			if (!bRetired)
+			{
+				UpdateSpaceConcurrent();
+			}
+			Unlock();
+			return(Success);
+		}
+	}
+
+	Unlock();
+	return(false);
+}
+
+void FSpatialBranch::InsertBatch(FSpatialRoot& Root, TArray<FSpatialBatchGroup*>& Pending, TArray<FVector>& OutLocations)
+{
+	// Every pending group fits into this branch, fill children one after the other
+	TArray<FSpatialBatchGroup*> Subset;
+	for (int32 Slot = 0; Slot < Slices && Pending.Num() > 0; Slot++)
+	{
+		FSpatialTree* Child = Children[Slot];
+		if (!Child)
+		{
+			// Open slot for the biggest remaining group
+			FSpatialBatchGroup& Group = *Pending[0];
+			bool bIsLeaf;
+			Child = CreateChild(Root, Slot, Group.Bounds, bIsLeaf);
+			if (bIsLeaf)
+			{
+				const int32 Index = Group.Items[Group.Placed++];
+				FSpatialHandle Handle;
+				Child->Insert(Root, Group.Bounds, OutLocations[Index], Handle);
+				if (Group.IsDone())
+				{
+					Pending.RemoveAt(0);
+				}
+				continue;
+			}
+		}
+
+		// Only descend with groups that can fit
+		Subset.Reset();
+		for (FSpatialBatchGroup* Group : Pending)
+		{
+			if (Child->HasSpace(Group->Bounds))
+			{
+				Subset.Emplace(Group);
+			}
+		}
+
+		if (Subset.Num() > 0)
+		{
+			Child->InsertBatch(Root, Subset, OutLocations);
+			Pending.RemoveAll([](const FSpatialBatchGroup* Group) { return Group->IsDone(); });
+		}
+	}
+
+	// Only update once for the whole batch
+	UpdateSpace();
+}
+
+bool FSpatialBranch::Remove(FSpatialRoot& Root, const FVector& Point)
+{
+	// Allocate to already existing child
+	for (FSpatialTree*& Child : GetChildren())
+	{
+		// Check if point is inside child
+		if (!Child || !Child->IsInside(Point))
+		{
+			continue;
+		}
+
+		Child = Root.Touch(Child);
+		if (Child->Remove(Root, Point))
+		{
+			// Remove child
+			Root.CountNode(Child, Depth + 1, -1);
+			Root.Drop(Child);
+			Child = nullptr;
+			Num--;
+
+			if (Reservation != INDEX_NONE)
+			{
+				Root.FreeSlabSlot(Reservation, int32(&Child - Children));
+			}
+		}
+	}
+
+	// Freed slices are available again
+	UpdateSpace();
+
+	// Delete if empty, reserved branches are kept for their slab
+	return(Num == 0 && Reservation == INDEX_NONE);
+}
+
+bool FSpatialBranch::RemoveConcurrent(FSpatialRoot& Root, const FVector& Point)
+{
+	int32 Slot = INDEX_NONE;
+	for (int32 Index = 0; Index < Slices; Index++)
+	{
+		if (Children[Index] && Children[Index]->IsInside(Point))
+		{
+			Slot = Index;
+			break;
+		}
+	}
+
+	FSpatialTree* Child = Slot != INDEX_NONE ? Children[Slot] : nullptr;
+	if (!Child)
+	{
+		const bool bEmpty = Num == 0;
+		Unlock();
+		return(bEmpty);
+	}
+
+	Child->Lock();
+	if (!Child->IsLeaf())
+	{
+		FSpatialBranch* Branch = static_cast<FSpatialBranch*>(Child);
+		Unlock();
+		Branch->RemoveConcurrent(Root, Point);
+
+		// Only prune the child if it is still ours and nobody refilled it
+		Lock();
+		if (bRetired)
+		{
+			Unlock();
+			return(true);
+		}
+
+		bool bPrune = false;
+		if (Children[Slot] == Child)
+		{
+			Child->Lock();
+			bPrune = Branch->Num == 0 && Branch->Reservation == INDEX_NONE;
+			if (!bPrune)
+			{
+				Child->Unlock();
+			}
+		}
+
+		if (!bPrune)
+		{
+			UpdateSpaceConcurrent();
+			const bool bEmpty = Num == 0;
+			Unlock();
+			return(bEmpty);
+		}
+	}
+
+	// Both locks are held, unlink so no new thread can reach the child.
+	// Threads already on their way back up will see it retired.
+	Children[Slot] = nullptr;
+	Num--;
+	Root.CountNode(Child, Depth + 1, -1);
+	Child->MarkRetired();
+	Child->Unlock();
+	Root.Retire(Child);
+
+	UpdateSpaceConcurrent();
+	const bool bEmpty = Num == 0;
+	Unlock();
+	return(bEmpty);
+}
+
+bool FSpatialBranch::Remove(FSpatialRoot& Root, const FSpatialHandle& Handle, int32 Level)
+{
+	// Handle ends on a branch, nothing to remove
+	const int32 Slot = Handle.GetSlot(Level, Root.PathBits);
+	if (Level >= Handle.Depth || Slot >= Slices)
+	{
+		return(false);
+	}
+
+	FSpatialTree*& Child = Children[Slot];
+	if (Child)
+	{
+		Child = Root.Touch(Child);
+	}
+
+	if (Child && Child->Remove(Root, Handle, Level + 1))
+	{
+		// Remove child
+		Root.CountNode(Child, Depth + 1, -1);
+		Root.Drop(Child);
+		Child = nullptr;
+		Num--;
+
+		if (Reservation != INDEX_NONE)
+		{
+			Root.FreeSlabSlot(Reservation, Slot);
+		}
+	}
+
+	// Freed slices are available again
+	UpdateSpace();
+
+	// Delete if empty, reserved branches are kept for their slab
+	return(Num == 0 && Reservation == INDEX_NONE);
+}
+
+void FSpatialBranch::ForEach(std::function<void(const FVector&, const FVector&, bool)> Func)
+{
+	// Call locally
+	const FVector Extend = Size / 2;
+	const FVector Center = Location + Extend;
+	Func(Center, Extend, false);
+
+	// Call for every child
+	for (FSpatialTree* Child : GetChildren())
+	{
+		if (Child)
+		{
+			Child->ForEach(Func);
+		}
+	}
+}
+
+void FSpatialBranch::Release(FSpatialRoot& Root)
+{
+	Root.Arena.Delete(this, GetAllocSize(Slices));
+}
+
+
+FSpatialRoot::FSpatialRoot(const FVector& Location, const FVector& Size, int32 Slices)
+	: Tree(nullptr), PathBits(FMath::CeilLogTwo(Slices)), bConcurrent(false), Placement(ESpatialPlacement::FirstFit), bRotate(false), bGrowable(false), MaxSize(Size), Growth(0), NextEpoch(1), bJournal(false)
+{
+	check(Slices > 1 && Slices <= FSpatialBranch::MaxSlices);
+	Tree = FSpatialBranch::Create(*this, Location, Size, EAxis::Z, Slices, 0);
+	UpdateCellSizes();
+	ResetCounters();
+}
+
+void FSpatialRoot::UpdateCellSizes()
+{
+	FVector Cell = Tree->GetSize();
+	EAxis::Type Axis = Tree->GetAxis();
+	const int32 Slices = Tree->GetChildren().Num();
+	for (FVector& CellSize : CellSizes)
+	{
+		Cell = FSpatialBranch::SliceSize(Cell, Axis, Slices);
+		CellSize = Cell;
+		Axis = FSpatialBranch::GetNext(Axis);
+	}
+}
+
+FSpatialRoot::~FSpatialRoot()
+{
+	// Nodes are freed with the arena
+}
+
+bool FSpatialRoot::Insert(const FVector& Bounds, FVector& Result)
+{
+	FSpatialHandle Handle;
+	return(Insert(Bounds, Result, Handle));
+}
+
+bool FSpatialRoot::Insert(const FVector& Bounds, FVector& Result, FSpatialHandle& OutHandle)
+{
+	ESpatialOrientation Orientation;
+	return(Insert(Bounds, Result, OutHandle, Orientation));
+}
+
+bool FSpatialRoot::Insert(const FVector& Bounds, FVector& Result, FSpatialHandle& OutHandle, ESpatialOrientation& OutOrientation)
+{
+	// Exact size classes skip the search
+	if (!bConcurrent && !IsSpeculating())
+	{
+		for (int32 Slab = 0; Slab < Slabs.Num(); Slab++)
+		{
+			if (Slabs[Slab].Bounds == Bounds)
+			{
+				if (InsertSlab(Slab, Result, OutHandle))
+				{
+					OutOrientation = ESpatialOrientation::XYZ;
+					OutHandle.Growth = uint8(Growth);
+					return(true);
+				}
+				break;
+			}
+		}
+	}
+
+	while (!InsertRotated(Bounds, Result, OutHandle, OutOrientation))
+	{
+		// Keep growing until the box fits or the limits are hit
+		if (!bGrowable || bConcurrent || IsSpeculating() || !Grow())
+		{
+			FailedInserts.fetch_add(1, std::memory_order_relaxed);
+			return(false);
+		}
+	}
+
+	OutHandle.Growth = uint8(Growth);
+	return(true);
+}
+
+bool FSpatialRoot::InsertRotated(const FVector& Bounds, FVector& Result, FSpatialHandle& OutHandle, ESpatialOrientation& OutOrientation)
+{
+	OutOrientation = ESpatialOrientation::XYZ;
+	if (!bRotate)
+	{
+		return(InsertOriented(Bounds, Result, OutHandle));
+	}
+
+	// Leaves always end up on the depth below the deepest one whose cells fit,
+	// so the deepest fit wastes the least space. Equal components give the same orientation twice.
+	TArray<TPair<int32, ESpatialOrientation>, TInlineAllocator<int32(ESpatialOrientation::Num)>> Candidates;
+	TArray<FVector, TInlineAllocator<int32(ESpatialOrientation::Num)>> Seen;
+	for (int32 Index = 0; Index < int32(ESpatialOrientation::Num); Index++)
+	{
+		const ESpatialOrientation Orientation = ESpatialOrientation(Index);
+		const FVector Oriented = Orient(Bounds, Orientation);
+		const int32 Depth = GetFitDepth(Oriented);
+		if (Depth != INDEX_NONE && !Seen.Contains(Oriented))
+		{
+			Seen.Emplace(Oriented);
+			Candidates.Emplace(Depth, Orientation);
+		}
+	}
+
+	// Stable so the given orientation wins ties
+	Candidates.StableSort([](const TPair<int32, ESpatialOrientation>& A, const TPair<int32, ESpatialOrientation>& B)
+	{
+		return A.Key > B.Key;
+	});
+
+	for (const TPair<int32, ESpatialOrientation>& Candidate : Candidates)
+	{
+		if (InsertOriented(Orient(Bounds, Candidate.Value), Result, OutHandle))
+		{
+			OutOrientation = Candidate.Value;
+			return(true);
+		}
+	}
+	return(false);
+}
+
+bool FSpatialRoot::InsertOriented(const FVector& Bounds, FVector& Result, FSpatialHandle& OutHandle)
+{
+	OutHandle = FSpatialHandle();
+	if (bConcurrent)
+	{
+		Tree->Lock();
+		if (!Tree->HasSpace(Bounds))
+		{
+			Tree->Unlock();
+		}
+		else if (Tree->InsertConcurrent(*this, Bounds, Result, OutHandle))
+		{
+			return(true);
+		}
+	}
+	else if (Tree->HasSpace(Bounds))
+	{
+		Tree = static_cast<FSpatialBranch*>(Touch(Tree));
+		if (Tree->Insert(*this, Bounds, Result, OutHandle))
+		{
+			return(true);
+		}
+	}
+
+	// Partial paths are meaningless
+	OutHandle = FSpatialHandle();
+	return(false);
+}
+
+int32 FSpatialRoot::InsertBatch(TArrayView<const FVector> Bounds, TArray<FVector>& OutLocations, TBitArray<>* OutPlaced)
+{
+	check(!bConcurrent);
+	check(!IsSpeculating());
+
+	const int32 Num = Bounds.Num();
+	OutLocations.Init(FVector::ZeroVector, Num);
+
+	// Cell sizes are the same for every node on the same depth, so boxes that stop
+	// splitting at the same depth are interchangeable and can be placed as one group.
+	TArray<FSpatialBatchGroup> Groups;
+	Groups.SetNum(FSpatialBranch::MaxDepth);
+	for (int32 Index = 0; Index < Num; Index++)
+	{
+		const FVector& Box = Bounds[Index];
+		const int32 Depth = GetFitDepth(Box);
+
+		// Boxes too big for the whole tree fail right away
+		if (Depth != INDEX_NONE)
+		{
+			FSpatialBatchGroup& Group = Groups[Depth];
+			Group.Bounds = Group.Bounds.ComponentMax(Box);
+			Group.Items.Emplace(Index);
+		}
+	}
+
+	// Place big boxes first, small ones fill the gaps
+	TArray<FSpatialBatchGroup*> Pending;
+	for (FSpatialBatchGroup& Group : Groups)
+	{
+		if (Group.Items.Num() > 0 && Tree->HasSpace(Group.Bounds))
+		{
+			Group.Items.Sort([&Bounds](int32 A, int32 B)
+			{
+				return Bounds[A].X * Bounds[A].Y * Bounds[A].Z > Bounds[B].X * Bounds[B].Y * Bounds[B].Z;
+			});
+			Pending.Emplace(&Group);
+		}
+	}
+
+	if (Pending.Num() > 0)
+	{
+		Tree->InsertBatch(*this, Pending, OutLocations);
+	}
+
+	int32 Count = 0;
+	TBitArray<> Placed(false, Num);
+	for (const FSpatialBatchGroup& Group : Groups)
+	{
+		for (int32 Item = 0; Item < Group.Placed; Item++)
+		{
+			Placed[Group.Items[Item]] = true;
+		}
+		Count += Group.Placed;
+	}
+
+	if (OutPlaced)
+	{
+		*OutPlaced = MoveTemp(Placed);
+	}
+	FailedInserts.fetch_add(Num - Count, std::memory_order_relaxed);
+	return Count;
+}
+
+bool FSpatialRoot::Remove(const FVector& Point)
+{
+	// Root branch stays alive even when empty
+	if (bConcurrent)
+	{
+		Tree->Lock();
+		return(Tree->RemoveConcurrent(*this, Point));
+	}
+
+	Tree = static_cast<FSpatialBranch*>(Touch(Tree));
+	return(Tree->Remove(*this, Point));
+}
+
+bool FSpatialRoot::Remove(const FSpatialHandle& Handle)
+{
+	check(!bConcurrent);
+	// Paths from before the root grew start further down
+	FSpatialHandle Lifted = Handle;
+	if (Handle.IsValid() && Handle.Growth < Growth)
+	{
+		Lifted.Lift(Growth - Handle.Growth, PathBits);
+	}
+
+	if (Lifted.IsValid())
+	{
+		Tree = static_cast<FSpatialBranch*>(Touch(Tree));
+		return(Tree->Remove(*this, Lifted, 0));
+	}
+	return(Tree->GetNum() == 0);
+}
+
+void FSpatialRoot::ForEach(std::function<void(const FVector&, const FVector&, bool)> Func)
+{
+	check(!bConcurrent);
+	Tree->ForEach(Func);
+}
+
+namespace
+{
+	// Collect leaves overlapping a region, Overlaps decides for a cell
+	template<typename OverlapType>
+	void QueryLeaves(const FSpatialTree* Node, const OverlapType& Overlaps, TArray<FBox>& OutLeaves)
+	{
+		const FBox Cell = Node->GetBox();
+		if (!Overlaps(Cell))
+		{
+			return;
+		}
+
+		if (Node->IsLeaf())
+		{
+			OutLeaves.Emplace(Cell);
+			return;
+		}
+
+		for (const FSpatialTree* Child : static_cast<const FSpatialBranch*>(Node)->GetChildren())
+		{
+			if (Child)
+			{
+				QueryLeaves(Child, Overlaps, OutLeaves);
+			}
+		}
+	}
+
+	void FindNearestFreeCell(const FSpatialBranch* Branch, const FVector& Bounds, const FVector& Point, FBox& Best, double& BestDistance)
+	{
+		const FVector Slice = Branch->SliceSize();
+		const bool bSliceFits = Bounds.X < Slice.X && Bounds.Y < Slice.Y && Bounds.Z < Slice.Z;
+
+		// Visit close slots first so far ones can be skipped
+		TArray<TPair<double, int32>, TInlineAllocator<16>> Order;
+		const TArrayView<FSpatialTree*> Children = Branch->GetChildren();
+		for (int32 Slot = 0; Slot < Children.Num(); Slot++)
+		{
+			const FSpatialTree* Child = Children[Slot];
+			FBox Cell;
+			if (Child)
+			{
+				// Leaves have no space
+				if (!Child->HasSpace(Bounds))
+				{
+					continue;
+				}
+				Cell = Child->GetBox();
+			}
+			else
+			{
+				if (!bSliceFits)
+				{
+					continue;
+				}
+
+				FVector Location, Size;
+				Branch->GetSlotCell(Slot, Location, Size);
+				Cell = FBox(Location, Location + Size);
+			}
+			Order.Emplace(Cell.ComputeSquaredDistanceToPoint(Point), Slot);
+		}
+
+		Order.Sort([](const TPair<double, int32>& A, const TPair<double, int32>& B) { return A.Key < B.Key; });
+		for (const TPair<double, int32>& Entry : Order)
+		{
+			if (Entry.Key >= BestDistance)
+			{
+				break;
+			}
+
+			const FSpatialTree* Child = Children[Entry.Value];
+			if (Child)
+			{
+				FindNearestFreeCell(static_cast<const FSpatialBranch*>(Child), Bounds, Point, Best, BestDistance);
+			}
+			else
+			{
+				FVector Location, Size;
+				Branch->GetSlotCell(Entry.Value, Location, Size);
+				Best = FBox(Location, Location + Size);
+				BestDistance = Entry.Key;
+			}
+		}
+	}
+}
+
+void FSpatialRoot::QueryBox(const FBox& Box, TArray<FBox>& OutLeaves) const
+{
+	check(!bConcurrent);
+
+	// Cells are half-open like IsInside
+	QueryLeaves(Tree, [&Box](const FBox& Cell)
+	{
+		return(Cell.Min.X <= Box.Max.X && Box.Min.X < Cell.Max.X &&
+			Cell.Min.Y <= Box.Max.Y && Box.Min.Y < Cell.Max.Y &&
+			Cell.Min.Z <= Box.Max.Z && Box.Min.Z < Cell.Max.Z);
+	}, OutLeaves);
+}
+
+void FSpatialRoot::QuerySphere(const FSphere& Sphere, TArray<FBox>& OutLeaves) const
+{
+	check(!bConcurrent);
+
+	const double RadiusSquared = FMath::Square(Sphere.W);
+	QueryLeaves(Tree, [&Sphere, RadiusSquared](const FBox& Cell)
+	{
+		return(FMath::SphereAABBIntersection(Sphere.Center, RadiusSquared, Cell));
+	}, OutLeaves);
+}
+
+bool FSpatialRoot::IsOccupied(const FVector& Point) const
+{
+	check(!bConcurrent);
+
+	// Cells don't overlap, so there is at most one path down
+	const FSpatialTree* Node = Tree;
+	while (Node && !Node->IsLeaf())
+	{
+		const FSpatialTree* Next = nullptr;
+		for (const FSpatialTree* Child : static_cast<const FSpatialBranch*>(Node)->GetChildren())
+		{
+			if (Child && Child->IsInside(Point))
+			{
+				Next = Child;
+				break;
+			}
+		}
+		Node = Next;
+	}
+	return(Node != nullptr);
+}
+
+bool FSpatialRoot::FindNearestFree(const FVector& Bounds, const FVector& Point, FBox& OutCell) const
+{
+	check(!bConcurrent);
+
+	if (!Tree->HasSpace(Bounds))
+	{
+		return(false);
+	}
+
+	double BestDistance = TNumericLimits<double>::Max();
+	FindNearestFreeCell(Tree, Bounds, Point, OutCell, BestDistance);
+	return(BestDistance < TNumericLimits<double>::Max());
+}
+
+namespace
+{
+	struct FCompactionLeaf
+	{
+		FVector Center;
+
+		// Depth of the branch holding the leaf
+		int32 Depth;
+
+		// Pre-order position
+		int32 Order;
+	};
+
+	void CollectCompactionLeaves(const FSpatialBranch* Branch, TArray<FCompactionLeaf>& OutLeaves)
+	{
+		for (const FSpatialTree* Child : Branch->GetChildren())
+		{
+			if (!Child)
+			{
+				continue;
+			}
+
+			if (Child->IsLeaf())
+			{
+				OutLeaves.Emplace(FCompactionLeaf{ Child->GetLocation() + Child->GetSize() / 2, Branch->GetDepth(), OutLeaves.Num() });
+			}
+			else
+			{
+				CollectCompactionLeaves(static_cast<const FSpatialBranch*>(Child), OutLeaves);
+			}
+		}
+	}
+
+	// Put a removed leaf back into the cell around Point, recreating branches on the way that got pruned with it
+	void RestoreCompactionLeaf(FSpatialRoot& Root, FSpatialBranch* Tree, const FVector& Point, int32 Depth)
+	{
+		FSpatialBranch* Branch = Tree;
+		while (Branch)
+		{
+			int32 Slot = INDEX_NONE;
+			for (int32 Index = 0; Index < Branch->GetChildren().Num(); Index++)
+			{
+				FVector Location, Size;
+				Branch->GetSlotCell(Index, Location, Size);
+				if (FBox(Location, Location + Size).IsInside(Point))
+				{
+					Slot = Index;
+					break;
+				}
+			}
+
+			if (Slot == INDEX_NONE)
+			{
+				break;
+			}
+
+			FSpatialTree* Child = Branch->GetChildren()[Slot];
+			if (Branch->GetDepth() == Depth)
+			{
+				check(!Child);
+				Branch->CreateChild(Root, Slot, true);
+				break;
+			}
+
+			if (!Child)
+			{
+				Child = Branch->CreateChild(Root, Slot, false);
+			}
+			Branch = Child->IsLeaf() ? nullptr : static_cast<FSpatialBranch*>(Child);
+		}
+		Tree->UpdateSpaceAt(Point);
+	}
+}
+
+void FSpatialRoot::Compact(TArray<FSpatialRemap>& OutRemap)
+{
+	FSpatialCompaction State;
+	Compact(State, TNumericLimits<double>::Max(), OutRemap);
+}
+
+bool FSpatialRoot::Compact(FSpatialCompaction& State, double TimeBudget, TArray<FSpatialRemap>& OutRemap)
+{
+	check(!bConcurrent);
+	check(!IsSpeculating());
+
+	const double Start = FPlatformTime::Seconds();
+	if (!State.bStarted)
+	{
+		TArray<FCompactionLeaf> Leaves;
+		CollectCompactionLeaves(Tree, Leaves);
+
+		// Big leaves first so small ones fill the gaps they leave, later ones first so they move the furthest
+		Leaves.Sort([](const FCompactionLeaf& A, const FCompactionLeaf& B)
+		{
+			return A.Depth != B.Depth ? A.Depth > B.Depth : A.Order < B.Order;
+		});
+
+		State.Pending.Reset(Leaves.Num());
+		for (const FCompactionLeaf& Leaf : Leaves)
+		{
+			State.Pending.Emplace(Leaf.Center);
+		}
+		State.bStarted = true;
+	}
+
+	// Always make some progress, even on a tiny budget
+	for (int32 Visited = 0; State.Pending.Num() > 0; Visited++)
+	{
+		if (Visited > 0 && FPlatformTime::Seconds() - Start > TimeBudget)
+		{
+			return(false);
+		}
+
+		// Find leaf again, the tree might have changed since it was collected
+		const FVector Point = State.Pending.Pop();
+		const FSpatialBranch* Parent = Tree;
+		const FSpatialTree* Node = nullptr;
+		while (Parent)
+		{
+			Node = nullptr;
+			for (const FSpatialTree* Child : Parent->GetChildren())
+			{
+				if (Child && Child->IsInside(Point))
+				{
+					Node = Child;
+					break;
+				}
+			}
+
+			if (!Node || Node->IsLeaf())
+			{
+				break;
+			}
+			Parent = static_cast<const FSpatialBranch*>(Node);
+		}
+
+		if (!Node || !Node->IsLeaf())
+		{
+			continue;
+		}
+
+		// The old cell is free again once removed, so the first free cell is never behind it
+		const FVector From = Node->GetLocation() + Node->GetSize() / 2;
+		const int32 Depth = Parent->GetDepth();
+		Tree->Remove(*this, From);
+
+		// Freeing the cell leaves room on this depth, but the allocation must not get lost if that ever fails
+		FVector To;
+		FSpatialHandle Handle;
+		if (!Tree->InsertAtDepth(*this, Depth, To, Handle))
+		{
+			RestoreCompactionLeaf(*this, Tree, From, Depth);
+			continue;
+		}
+
+		// Paths can change even if the cell stays the same, so every allocation is reported
+		Handle.Growth = uint8(Growth);
+		OutRemap.Emplace(FSpatialRemap{ From, To, Handle });
+	}
+	return(true);
+}
+
+void FSpatialRoot::Reset()
+{
+	check(!bConcurrent);
+	check(!IsSpeculating());
+	Retired.Reset();
+
+	const FVector Location = Tree->GetLocation();
+	const FVector Size = Tree->GetSize();
+	const int32 Slices = Tree->GetChildren().Num();
+	const EAxis::Type Axis = Tree->GetAxis();
+
+	// Drop every node at once
+	Arena.Reset();
+	Tree = FSpatialBranch::Create(*this, Location, Size, Axis, Slices, 0);
+	ResetCounters();
+	ResetSlabs();
+	Growth = 0;
+
+	if (bJournal)
+	{
+		ClearChanges();
+	}
+}
+
+void FSpatialRoot::SetConcurrent(bool bEnable)
+{
+	check(!IsSpeculating());
+	bConcurrent = bEnable;
+	Arena.SetThreadSafe(bEnable);
+
+	// Nobody can be inside a retired node anymore
+	if (!bEnable)
+	{
+		Flush();
+		RebuildSlabs();
+	}
+}
+
+bool FSpatialRoot::IsConcurrent() const
+{
+	return bConcurrent;
+}
+
+void FSpatialRoot::SetPlacement(ESpatialPlacement NewPlacement)
+{
+	Placement = NewPlacement;
+}
+
+ESpatialPlacement FSpatialRoot::GetPlacement() const
+{
+	return Placement;
+}
+
+void FSpatialRoot::SetGrowable(bool bEnable, const FVector& NewMaxSize)
+{
+	bGrowable = bEnable;
+	MaxSize = NewMaxSize;
+}
+
+bool FSpatialRoot::IsGrowable() const
+{
+	return bGrowable;
+}
+
+bool FSpatialRoot::Grow()
+{
+	check(!bConcurrent);
+	check(!IsSpeculating());
+
+	// Every node moves one level down
+	if (BranchDepths[FSpatialBranch::MaxDepth - 1].load(std::memory_order_relaxed) > 0 || LeafDepths[FSpatialBranch::MaxDepth].load(std::memory_order_relaxed) > 0)
+	{
+		return(false);
+	}
+
+	// Split along the axis before the old root's so cell sizes on every depth stay the same
+	EAxis::Type Axis = EAxis::Z;
+	for (EAxis::Type Candidate : { EAxis::X, EAxis::Y, EAxis::Z })
+	{
+		if (FSpatialBranch::GetNext(Candidate) == Tree->GetAxis())
+		{
+			Axis = Candidate;
+		}
+	}
+
+	const int32 Slices = Tree->GetChildren().Num();
+	FVector Size = Tree->GetSize();
+	Size.SetComponentForAxis(Axis, Size.GetComponentForAxis(Axis) * Slices);
+	if (Size.X > MaxSize.X || Size.Y > MaxSize.Y || Size.Z > MaxSize.Z)
+	{
+		return(false);
+	}
+
+	Tree->Deepen();
+	FSpatialBranch* Parent = FSpatialBranch::Create(*this, Tree->GetLocation(), Size, Axis, Slices, 0);
+	Parent->Adopt(0, Tree);
+	Tree = Parent;
+	UpdateCellSizes();
+
+	// Counters move down with their nodes
+	for (int32 Depth = FSpatialBranch::MaxDepth; Depth > 0; Depth--)
+	{
+		LeafDepths[Depth].store(LeafDepths[Depth - 1].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		BranchDepths[Depth].store(BranchDepths[Depth - 1].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+	LeafDepths[0].store(0, std::memory_order_relaxed);
+	BranchDepths[0].store(1, std::memory_order_relaxed);
+
+	Growth++;
+	return(true);
+}
+
+bool FSpatialRoot::AddSlab(const FVector& Bounds)
+{
+	check(!bConcurrent);
+	if (GetFitDepth(Bounds) < 1)
+	{
+		return(false);
+	}
+
+	for (const FSpatialSlab& Slab : Slabs)
+	{
+		if (Slab.Bounds == Bounds)
+		{
+			return(true);
+		}
+	}
+
+	FSpatialSlab Slab;
+	Slab.Bounds = Bounds;
+	Slabs.Emplace(MoveTemp(Slab));
+	return(true);
+}
+
+bool FSpatialRoot::InsertSlab(int32 Slab, FVector& Result, FSpatialHandle& OutHandle)
+{
+	const int32 Slices = Tree->GetChildren().Num();
+	TArray<int32>& FreeSlots = Slabs[Slab].FreeSlots;
+	while (FreeSlots.Num() > 0)
+	{
+		const int32 Free = FreeSlots.Pop();
+		const int32 Reservation = Free / Slices;
+		const int32 Slot = Free % Slices;
+
+		// Regular inserts may have used the slot in the meantime
+		if (!Reservations[Reservation].Branch->GetChildren()[Slot])
+		{
+			TakeSlabSlot(Reservation, Slot, Result, OutHandle);
+			return(true);
+		}
+	}
+
+	// All reserved branches are full, leaves go one level below the branch like regular inserts would put them
+	const int32 Depth = GetFitDepth(Slabs[Slab].Bounds);
+	FSpatialHandle Path;
+	FSpatialBranch* Branch = Depth >= 1 ? Tree->InsertBranchAtDepth(*this, Depth, Path) : nullptr;
+	if (!Branch)
+	{
+		return(false);
+	}
+
+	Path.Growth = uint8(Growth);
+	const int32 Reservation = Reservations.Emplace(FSpatialReservation{ Branch, Path, Slab });
+	Branch->SetReservation(Reservation);
+
+	// Hand out slots front to back
+	for (int32 Slot = Slices - 1; Slot > 0; Slot--)
+	{
+		FreeSlots.Emplace(Reservation * Slices + Slot);
+	}
+	TakeSlabSlot(Reservation, 0, Result, OutHandle);
+	return(true);
+}
+
+void FSpatialRoot::TakeSlabSlot(int32 Reservation, int32 Slot, FVector& Result, FSpatialHandle& OutHandle)
+{
+	const FSpatialReservation& Entry = Reservations[Reservation];
+	FSpatialBranch* Branch = Entry.Branch;
+	const FSpatialTree* Leaf = Branch->CreateChild(*this, Slot, true);
+	Branch->UpdateSpace();
+	Result = Leaf->GetLocation() + Leaf->GetSize() / 2;
+
+	OutHandle = Entry.Path;
+	OutHandle.Lift(Growth - Entry.Path.Growth, PathBits);
+	OutHandle.Push(Slot, PathBits);
+
+	// Space and free depths of a branch only change once its last slot is taken
+	if (Branch->GetNum() == Branch->GetChildren().Num())
+	{
+		Tree->UpdateSpaceAt(Result);
+	}
+}
+
+void FSpatialRoot::FreeSlabSlot(int32 Reservation, int32 Slot)
+{
+	const int32 Slices = Tree->GetChildren().Num();
+	Slabs[Reservations[Reservation].Slab].FreeSlots.Emplace(Reservation * Slices + Slot);
+}
+
+void FSpatialRoot::ResetSlabs()
+{
+	Reservations.Reset();
+	for (FSpatialSlab& Slab : Slabs)
+	{
+		Slab.FreeSlots.Reset();
+	}
+}
+
+void FSpatialRoot::RebuildSlabs()
+{
+	const int32 Slices = Tree->GetChildren().Num();
+	for (FSpatialSlab& Slab : Slabs)
+	{
+		Slab.FreeSlots.Reset();
+	}
+
+	// Back to front so slots are handed out front to back again
+	for (int32 Reservation = Reservations.Num() - 1; Reservation >= 0; Reservation--)
+	{
+		const FSpatialReservation& Entry = Reservations[Reservation];
+		for (int32 Slot = Slices - 1; Slot >= 0; Slot--)
+		{
+			if (!Entry.Branch->GetChildren()[Slot])
+			{
+				Slabs[Entry.Slab].FreeSlots.Emplace(Reservation * Slices + Slot);
+			}
+		}
+	}
+}
+
+void FSpatialRoot::BeginSpeculation()
+{
+	check(!bConcurrent);
+
+	FSpatialSpeculation& Speculation = Speculations.Emplace_GetRef();
+	Speculation.Tree = Tree;
+	Speculation.Epoch = NextEpoch++;
+	for (int32 Depth = 0; Depth <= FSpatialBranch::MaxDepth; Depth++)
+	{
+		Speculation.LeafDepths[Depth] = LeafDepths[Depth].load(std::memory_order_relaxed);
+		Speculation.BranchDepths[Depth] = BranchDepths[Depth].load(std::memory_order_relaxed);
+	}
+}
+
+void FSpatialRoot::CommitSpeculation()
+{
+	check(IsSpeculating());
+	FSpatialSpeculation Speculation = Speculations.Pop();
+
+	// The enclosing speculation takes over, its discard still has to get back to its own start
+	if (IsSpeculating())
+	{
+		FSpatialSpeculation& Outer = Speculations.Last();
+		for (FSpatialTree* Node : Speculation.Created)
+		{
+			Node->SetEpoch(Outer.Epoch);
+		}
+		Outer.Created.Append(Speculation.Created);
+		Outer.Garbage.Append(Speculation.Garbage);
+		return;
+	}
+
+	// Leaves from before that were unlinked are gone, leaves created and unlinked again never showed up
+	if (bJournal)
+	{
+		TSet<const FSpatialTree*> Dead;
+		for (const FSpatialTree* Node : Speculation.Garbage)
+		{
+			if (Node->IsLeaf())
+			{
+				if (Node->GetEpoch() >= Speculation.Epoch)
+				{
+					Dead.Add(Node);
+				}
+				else
+				{
+					RecordChange(Node, false);
+				}
+			}
+		}
+
+		for (const FSpatialTree* Node : Speculation.Created)
+		{
+			if (Node->IsLeaf() && !Dead.Contains(Node))
+			{
+				RecordChange(Node, true);
+			}
+		}
+	}
+
+	// Copies of reserved branches replace their originals, later copies are the live ones
+	for (FSpatialTree* Node : Speculation.Created)
+	{
+		if (!Node->IsLeaf())
+		{
+			FSpatialBranch* Branch = static_cast<FSpatialBranch*>(Node);
+			if (Branch->GetReservation() != INDEX_NONE)
+			{
+				Reservations[Branch->GetReservation()].Branch = Branch;
+			}
+		}
+	}
+
+	for (FSpatialTree* Node : Speculation.Garbage)
+	{
+		Node->Release(*this);
+	}
+}
+
+void FSpatialRoot::DiscardSpeculation()
+{
+	check(IsSpeculating());
+	FSpatialSpeculation Speculation = Speculations.Pop();
+
+	// Nothing from before was changed in place
+	Tree = Speculation.Tree;
+	for (FSpatialTree* Node : Speculation.Created)
+	{
+		Node->Release(*this);
+	}
+
+	for (int32 Depth = 0; Depth <= FSpatialBranch::MaxDepth; Depth++)
+	{
+		LeafDepths[Depth].store(Speculation.LeafDepths[Depth], std::memory_order_relaxed);
+		BranchDepths[Depth].store(Speculation.BranchDepths[Depth], std::memory_order_relaxed);
+	}
+}
+
+bool FSpatialRoot::IsSpeculating() const
+{
+	return Speculations.Num() > 0;
+}
+
+FSpatialTree* FSpatialRoot::Touch(FSpatialTree* Node)
+{
+	// Leaves never change, they are only unlinked
+	if (!IsSpeculating() || Node->IsLeaf() || Node->GetEpoch() >= Speculations.Last().Epoch)
+	{
+		return(Node);
+	}
+
+	Speculations.Last().Garbage.Emplace(Node);
+	return(static_cast<FSpatialBranch*>(Node)->Clone(*this));
+}
+
+void FSpatialRoot::Track(FSpatialTree* Node)
+{
+	if (IsSpeculating())
+	{
+		FSpatialSpeculation& Speculation = Speculations.Last();
+		Node->SetEpoch(Speculation.Epoch);
+		Speculation.Created.Emplace(Node);
+	}
+}
+
+void FSpatialRoot::Drop(FSpatialTree* Node)
+{
+	if (IsSpeculating())
+	{
+		Speculations.Last().Garbage.Emplace(Node);
+	}
+	else
+	{
+		Node->Release(*this);
+	}
+}
+
+void FSpatialRoot::SetRotate(bool bEnable)
+{
+	bRotate = bEnable;
+}
+
+bool FSpatialRoot::CanRotate() const
+{
+	return bRotate;
+}
+
+FVector FSpatialRoot::Orient(const FVector& Bounds, ESpatialOrientation Orientation)
+{
+	switch (Orientation)
+	{
+	case ESpatialOrientation::XZY: return FVector(Bounds.X, Bounds.Z, Bounds.Y);
+	case ESpatialOrientation::YXZ: return FVector(Bounds.Y, Bounds.X, Bounds.Z);
+	case ESpatialOrientation::YZX: return FVector(Bounds.Y, Bounds.Z, Bounds.X);
+	case ESpatialOrientation::ZXY: return FVector(Bounds.Z, Bounds.X, Bounds.Y);
+	case ESpatialOrientation::ZYX: return FVector(Bounds.Z, Bounds.Y, Bounds.X);
+	default: return Bounds;
+	}
+}
+
+int32 FSpatialRoot::GetFitDepth(const FVector& Bounds) const
+{
+	int32 Depth = 0;
+	while (Depth < FSpatialBranch::MaxDepth && Bounds.X < CellSizes[Depth].X && Bounds.Y < CellSizes[Depth].Y && Bounds.Z < CellSizes[Depth].Z)
+	{
+		Depth++;
+	}
+	return(Depth - 1);
+}
+
+void FSpatialRoot::Retire(FSpatialTree* Node)
+{
+	FScopeLock Lock(&RetiredMutex);
+	Retired.Emplace(Node);
+}
+
+void FSpatialRoot::Flush()
+{
+	for (FSpatialTree* Node : Retired)
+	{
+		Node->Release(*this);
+	}
+	Retired.Reset();
+}
+
+void FSpatialRoot::CountNode(const FSpatialTree* Node, int32 Depth, int32 Delta)
+{
+	const bool bIsLeaf = Node->IsLeaf();
+	std::atomic<int32>& Counter = bIsLeaf ? LeafDepths[Depth] : BranchDepths[Depth];
+	Counter.fetch_add(Delta, std::memory_order_relaxed);
+
+	// Speculative changes are recorded on commit
+	if (bJournal && bIsLeaf && !IsSpeculating())
+	{
+		RecordChange(Node, Delta > 0);
+	}
+}
+
+void FSpatialRoot::RecordChange(const FSpatialTree* Leaf, bool bAdded)
+{
+	if (bConcurrent)
+	{
+		FScopeLock Lock(&JournalMutex);
+		RecordChangeInternal(Leaf, bAdded);
+	}
+	else
+	{
+		RecordChangeInternal(Leaf, bAdded);
+	}
+}
+
+void FSpatialRoot::RecordChangeInternal(const FSpatialTree* Leaf, bool bAdded)
+{
+	const FVector Extend = Leaf->GetSize() / 2;
+	const FVector Center = Leaf->GetLocation() + Extend;
+	if (bAdded)
+	{
+		PendingAdded.Add(Center, Changes.AddedCenters.Num());
+		Changes.AddedCenters.Emplace(Center);
+		Changes.AddedExtends.Emplace(Extend);
+		return;
+	}
+
+	// Live leaves never share a center, so a match is this very leaf and consumers never saw it
+	if (const int32* Found = PendingAdded.Find(Center))
+	{
+		const int32 Index = *Found;
+		const int32 Last = Changes.AddedCenters.Num() - 1;
+		if (Index != Last)
+		{
+			PendingAdded.Add(Changes.AddedCenters[Last], Index);
+		}
+		Changes.AddedCenters.RemoveAtSwap(Index);
+		Changes.AddedExtends.RemoveAtSwap(Index);
+		PendingAdded.Remove(Center);
+		return;
+	}
+
+	Changes.RemovedCenters.Emplace(Center);
+	Changes.RemovedExtends.Emplace(Extend);
+}
+
+void FSpatialRoot::ClearChanges()
+{
+	Changes = FSpatialChanges();
+	Changes.bCleared = true;
+	PendingAdded.Reset();
+}
+
+void FSpatialRoot::SetJournal(bool bEnable)
+{
+	check(!bConcurrent);
+	bJournal = bEnable;
+	Changes = FSpatialChanges();
+	PendingAdded.Reset();
+}
+
+bool FSpatialRoot::HasJournal() const
+{
+	return bJournal;
+}
+
+void FSpatialRoot::DrainChanges(FSpatialChanges& OutChanges)
+{
+	FScopeLock Lock(&JournalMutex);
+	OutChanges = MoveTemp(Changes);
+	Changes = FSpatialChanges();
+	PendingAdded.Reset();
+}
+
+void FSpatialRoot::ResetCounters()
+{
+	for (int32 Depth = 0; Depth <= FSpatialBranch::MaxDepth; Depth++)
+	{
+		LeafDepths[Depth].store(0, std::memory_order_relaxed);
+		BranchDepths[Depth].store(0, std::memory_order_relaxed);
+	}
+	BranchDepths[0].store(1, std::memory_order_relaxed);
+	FailedInserts.store(0, std::memory_order_relaxed);
+}
+
+void FSpatialRoot::GetStats(FSpatialStats& OutStats) const
+{
+	OutStats = FSpatialStats();
+	OutStats.Bytes = Arena.GetUsedBytes();
+	OutStats.FailedInserts = FailedInserts.load(std::memory_order_relaxed);
+
+	const FVector Size = Tree->GetSize();
+	const double TotalVolume = Size.X * Size.Y * Size.Z;
+	for (int32 Depth = 0; Depth <= FSpatialBranch::MaxDepth; Depth++)
+	{
+		const int32 Leaves = LeafDepths[Depth].load(std::memory_order_relaxed);
+		const int32 Branches = BranchDepths[Depth].load(std::memory_order_relaxed);
+		if (Leaves == 0 && Branches == 0)
+		{
+			continue;
+		}
+
+		OutStats.LeafDepths.SetNumZeroed(Depth + 1);
+		OutStats.BranchDepths.SetNumZeroed(Depth + 1);
+		OutStats.LeafDepths[Depth] = Leaves;
+		OutStats.BranchDepths[Depth] = Branches;
+		OutStats.LeafNum += Leaves;
+		OutStats.BranchNum += Branches;
+
+		// Leaves always fill the whole cell of their parent's slot
+		if (Depth > 0)
+		{
+			const FVector& Cell = CellSizes[Depth - 1];
+			OutStats.OccupiedVolume += Leaves * Cell.X * Cell.Y * Cell.Z;
+		}
+	}
+	OutStats.FreeVolume = TotalVolume - OutStats.OccupiedVolume;
+
+	// Space of the root is the biggest free cell anywhere in the tree
+	if (bConcurrent)
+	{
+		Tree->Lock();
+		OutStats.LargestFree = Tree->GetSpace();
+		Tree->Unlock();
+	}
+	else
+	{
+		OutStats.LargestFree = Tree->GetSpace();
+	}
+}
+
+void FSpatialRoot::PublishStats() const
+{
+	FSpatialStats Stats;
+	GetStats(Stats);
+
+	const double TotalVolume = Stats.OccupiedVolume + Stats.FreeVolume;
+	SET_DWORD_STAT(STAT_SpatialTreeLeaves, Stats.LeafNum);
+	SET_DWORD_STAT(STAT_SpatialTreeBranches, Stats.BranchNum);
+	SET_DWORD_STAT(STAT_SpatialTreeDepth, Stats.LeafDepths.Num());
+	SET_MEMORY_STAT(STAT_SpatialTreeBytes, Stats.Bytes);
+	SET_FLOAT_STAT(STAT_SpatialTreeOccupied, TotalVolume > 0.0 ? Stats.OccupiedVolume / TotalVolume * 100.0 : 0.0);
+	SET_FLOAT_STAT(STAT_SpatialTreeLargestFree, Stats.LargestFree.GetMin());
+	SET_DWORD_STAT(STAT_SpatialTreeFailedInserts, Stats.FailedInserts);
+}
+
+namespace
+{
+	constexpr uint32 SnapshotMagic = 0x52545053;
+	constexpr uint32 SnapshotVersion = 3;
+
+
+	struct FSpatialSnapshotHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		int32 Slices;
+		int32 Axis;
+
+		// Fixed width so snapshots don't depend on whether FVector is float or double
+		double Location[3];
+		double Size[3];
+
+		// Number of stored slot tags
+		int32 SlotNum;
+
+		// Number of times the root grew, handles made before store less levels
+		int32 Growth;
+	};
+
+	// Slot tags, packed with two bits each in pre-order.
+	// Cell bounds follow from the root and Space is recomputed, so nothing else needs to be stored.
+	enum class ESnapshotSlot : uint8
+	{
+		Empty = 0,
+		Leaf = 1,
+		Branch = 2
+	};
+
+	void PushSlot(ESnapshotSlot Tag, TArray<uint8>& Data, int32& SlotNum)
+	{
+		if (SlotNum % 4 == 0)
+		{
+			Data.Emplace(0);
+		}
+		Data.Last() |= uint8(Tag) << ((SlotNum % 4) * 2);
+		SlotNum++;
+	}
+
+	// Returns whether any leaf was written. Branches without leaves, like empty slab reservations, are stored as empty slots
+	bool SaveSlots(const FSpatialBranch* Branch, TArray<uint8>& Data, int32& SlotNum)
+	{
+		bool bAnyLeaf = false;
+		for (const FSpatialTree* Child : Branch->GetChildren())
+		{
+			if (!Child)
+			{
+				PushSlot(ESnapshotSlot::Empty, Data, SlotNum);
+			}
+			else if (Child->IsLeaf())
+			{
+				PushSlot(ESnapshotSlot::Leaf, Data, SlotNum);
+				bAnyLeaf = true;
+			}
+			else
+			{
+				const int32 Start = SlotNum;
+				PushSlot(ESnapshotSlot::Branch, Data, SlotNum);
+				if (SaveSlots(static_cast<const FSpatialBranch*>(Child), Data, SlotNum))
+				{
+					bAnyLeaf = true;
+					continue;
+				}
+
+				// Roll back to before the branch and clear the tags packed after it, data starts with the header
+				Data.SetNum(Data.Num() - (Align(SlotNum, 4) - Align(Start, 4)) / 4);
+				SlotNum = Start;
+				if (SlotNum % 4 != 0)
+				{
+					Data.Last() &= uint8((1 << ((SlotNum % 4) * 2)) - 1);
+				}
+				PushSlot(ESnapshotSlot::Empty, Data, SlotNum);
+			}
+		}
+		return(bAnyLeaf);
+	}
+
+	bool LoadSlots(FSpatialRoot& Root, FSpatialBranch* Branch, const uint8* Slots, int32 SlotNum, int32& Cursor, int32 Depth)
+	{
+
+		const int32 Slices = Branch->GetChildren().Num();
+		for (int32 Slot = 0; Slot < Slices; Slot++)
+		{
+			if (Cursor >= SlotNum)
+			{
+				return(false);
+			}
+
+			const ESnapshotSlot Tag = ESnapshotSlot((Slots[Cursor / 4] >> ((Cursor % 4) * 2)) & 0b11);
+			Cursor++;
+
+			if (Tag == ESnapshotSlot::Leaf)
+			{
+				Branch->CreateChild(Root, Slot, true);
+			}
+			else if (Tag == ESnapshotSlot::Branch)
+			{
+				// Same depth limit as inserts, which also keeps broken data from blowing the stack
+				if (Depth + 1 >= FSpatialBranch::MaxDepth)
+				{
+					return(false);
+				}
+
+				FSpatialTree* Child = Branch->CreateChild(Root, Slot, false);
+				if (!LoadSlots(Root, static_cast<FSpatialBranch*>(Child), Slots, SlotNum, Cursor, Depth + 1))
+				{
+					return(false);
+				}
+			}
+			else if (Tag != ESnapshotSlot::Empty)
+			{
+				return(false);
+			}
+		}
+
+		// Children are done, so space bubbles up like after an insert
+		Branch->UpdateSpace();
+		return(true);
+	}
+}
+
+void FSpatialRoot::Save(TArray<uint8>& OutData) const
+{
+	check(!bConcurrent);
+
+	FSpatialSnapshotHeader Header;
+	FMemory::Memzero(&Header, sizeof(FSpatialSnapshotHeader));
+	Header.Magic = SnapshotMagic;
+	Header.Version = SnapshotVersion;
+	Header.Slices = Tree->GetChildren().Num();
+	Header.Axis = int32(Tree->GetAxis());
+	Header.Growth = Growth;
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		Header.Location[Axis] = Tree->GetLocation()[Axis];
+		Header.Size[Axis] = Tree->GetSize()[Axis];
+	}
+
+	OutData.Reset();
+	OutData.AddZeroed(sizeof(FSpatialSnapshotHeader));
+	SaveSlots(Tree, OutData, Header.SlotNum);
+	FMemory::Memcpy(OutData.GetData(), &Header, sizeof(FSpatialSnapshotHeader));
+}
+
+bool FSpatialRoot::Load(TArrayView<const uint8> Data)
+{
+	check(!bConcurrent);
+	check(!IsSpeculating());
+
+	FSpatialSnapshotHeader Header;
+	if (Data.Num() < int32(sizeof(FSpatialSnapshotHeader)))
+	{
+		Reset();
+		return(false);
+	}
+	FMemory::Memcpy(&Header, Data.GetData(), sizeof(FSpatialSnapshotHeader));
+
+	const bool bValid = Header.Magic == SnapshotMagic && Header.Version == SnapshotVersion &&
+		Header.Slices > 1 && Header.Slices <= FSpatialBranch::MaxSlices && Header.SlotNum >= 0 &&
+		Header.Growth >= 0 && Header.Growth <= FSpatialBranch::MaxDepth &&
+		(Header.Axis == EAxis::X || Header.Axis == EAxis::Y || Header.Axis == EAxis::Z) &&
+		Data.Num() - int32(sizeof(FSpatialSnapshotHeader)) >= (Header.SlotNum + 3) / 4;
+	if (!bValid)
+	{
+		Reset();
+		return(false);
+	}
+
+	// Start over with the snapshot's root
+	Arena.Reset();
+	Retired.Reset();
+	PathBits = FMath::CeilLogTwo(Header.Slices);
+	const FVector Location(Header.Location[0], Header.Location[1], Header.Location[2]);
+	const FVector Size(Header.Size[0], Header.Size[1], Header.Size[2]);
+	Tree = FSpatialBranch::Create(*this, Location, Size, EAxis::Type(Header.Axis), Header.Slices, 0);
+	UpdateCellSizes();
+	ResetCounters();
+	ResetSlabs();
+	Growth = Header.Growth;
+
+	// Loaded leaves are recorded as added
+	if (bJournal)
+	{
+		ClearChanges();
+	}
+
+	int32 Cursor = 0;
+	const uint8* Slots = Data.GetData() + sizeof(FSpatialSnapshotHeader);
+	if (!LoadSlots(*this, Tree, Slots, Header.SlotNum, Cursor, 0) || Cursor != Header.SlotNum)
+	{
+		Reset();
+		return(false);
+	}
+	return(true);
+}
+
+const FSpatialBranch* FSpatialRoot::GetTree() const
+{
+	return Tree;
+}
+
+const FSpatialArena& FSpatialRoot::GetArena() const
+{
+	return Arena;
+}
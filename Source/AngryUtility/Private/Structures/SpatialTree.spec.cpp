@@ -0,0 +1,1416 @@
+#include "Structures/SpatialTree.h"
+#include "Structures/SpatialFlatTree.h"
+#include "Structures/SpatialBuddyTree.h"
+#include "Structures/SpatialGridTree.h"
+
+#include "Async/ParallelFor.h"
+#include "Misc/AutomationTest.h"
+
+struct FTestCell
+{
+    FVector Center;
+    FVector Extend;
+};
+
+template<typename TreeType>
+TArray<FTestCell> CollectLeaves(TreeType& Tree)
+{
+    TArray<FTestCell> Cells;
+    Tree.ForEach([&Cells](const FVector& Center, const FVector& Extend, bool IsLeaf)
+    {
+        if (IsLeaf)
+        {
+            Cells.Emplace(FTestCell{ Center, Extend });
+        }
+    });
+    return Cells;
+}
+
+bool CellsOverlap(const FTestCell& A, const FTestCell& B)
+{
+    const FVector Delta = (A.Center - B.Center).GetAbs();
+    const FVector Reach = A.Extend + B.Extend - FVector(KINDA_SMALL_NUMBER);
+    return Delta.X < Reach.X && Delta.Y < Reach.Y && Delta.Z < Reach.Z;
+}
+
+bool AnyOverlap(const TArray<FTestCell>& Cells)
+{
+    for (int32 I = 0; I < Cells.Num(); I++)
+    {
+        for (int32 J = I + 1; J < Cells.Num(); J++)
+        {
+            if (CellsOverlap(Cells[I], Cells[J]))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+TArray<FVector> RandomBounds(int32 Seed, int32 Num, float Min, float Max)
+{
+    FRandomStream Stream(Seed);
+    TArray<FVector> Bounds;
+    for (int32 I = 0; I < Num; I++)
+    {
+        Bounds.Emplace(FVector(Stream.FRandRange(Min, Max), Stream.FRandRange(Min, Max), Stream.FRandRange(Min, Max)));
+    }
+    return Bounds;
+}
+
+DEFINE_SPEC(SpatialTreeSpec, "Angry.SpatialTreeSpec", EAutomationTestFlags::ProductFilter | EAutomationTestFlags::ApplicationContextMask)
+void SpatialTreeSpec::Define()
+{
+    const FVector Location = FVector::ZeroVector;
+    const FVector Size = FVector(100.0f);
+
+    auto DescribeTree = [this, Location, Size](const FString& Name, auto MakeTree)
+    {
+        Describe(Name, [this, Location, Size, MakeTree]()
+        {
+            It("should place boxes inside the volume without overlap", [this, Location, Size, MakeTree]()
+            {
+                auto Tree = MakeTree(Location, Size, 2);
+                int32 Placed = 0;
+                for (const FVector& Bounds : RandomBounds(1, 500, 1.0f, 20.0f))
+                {
+                    FVector Result;
+                    if (Tree->Insert(Bounds, Result))
+                    {
+                        TestTrue("Inside", FBox(Location, Location + Size).IsInside(Result));
+                        Placed++;
+                    }
+                }
+
+                const TArray<FTestCell> Cells = CollectLeaves(*Tree);
+                TestEqual("Leaves", Cells.Num(), Placed);
+                TestFalse("Overlap", AnyOverlap(Cells));
+            });
+
+            It("should reject boxes bigger than the volume", [this, Location, Size, MakeTree]()
+            {
+                auto Tree = MakeTree(Location, Size, 2);
+                FVector Result;
+                TestFalse("Insert", Tree->Insert(Size * 2, Result));
+                TestEqual("Leaves", CollectLeaves(*Tree).Num(), 0);
+            });
+
+            It("should be empty after removing every box", [this, Location, Size, MakeTree]()
+            {
+                auto Tree = MakeTree(Location, Size, 3);
+                TArray<FVector> Results;
+                for (const FVector& Bounds : RandomBounds(2, 300, 1.0f, 20.0f))
+                {
+                    FVector Result;
+                    if (Tree->Insert(Bounds, Result))
+                    {
+                        Results.Emplace(Result);
+                    }
+                }
+
+                bool Empty = false;
+                for (const FVector& Result : Results)
+                {
+                    Empty = Tree->Remove(Result);
+                }
+                TestTrue("Empty", Empty);
+                TestEqual("Leaves", CollectLeaves(*Tree).Num(), 0);
+            });
+
+            It("should reuse freed space", [this, Location, Size, MakeTree]()
+            {
+                auto Tree = MakeTree(Location, Size, 2);
+                const FVector Bounds = Size * 0.4f;
+
+                TArray<FVector> Results;
+                FVector Result;
+                while (Tree->Insert(Bounds, Result))
+                {
+                    Results.Emplace(Result);
+                }
+                TestEqual("Full", Results.Num(), 8);
+
+                Tree->Remove(Results[3]);
+                TestTrue("Insert", Tree->Insert(Bounds, Result));
+                TestEqual("Reused", Result, Results[3]);
+            });
+        });
+    };
+
+    DescribeTree("FSpatialRoot", [](const FVector& Location, const FVector& Size, int32 Slices)
+    {
+        return MakeUnique<FSpatialRoot>(Location, Size, Slices);
+    });
+
+    DescribeTree("FSpatialFlatTree", [](const FVector& Location, const FVector& Size, int32 Slices)
+    {
+        return MakeUnique<FSpatialFlatTree>(Location, Size, Slices);
+    });
+
+    DescribeTree("FSpatialBuddyTree", [](const FVector& Location, const FVector& Size, int32 Slices)
+    {
+        return MakeUnique<FSpatialBuddyTree>(Location, Size.X, Size.X / 64);
+    });
+
+    Describe("FSpatialBuddyTree buddies", [this, Location, Size]()
+    {
+        It("should round up to power-of-two blocks", [this, Location, Size]()
+        {
+            FSpatialBuddyTree Tree(Location, Size.X, 1.0f);
+            FVector Result;
+            TestTrue("Insert", Tree.Insert(FVector(10.0f, 3.0f, 1.0f), Result));
+
+            const TArray<FTestCell> Cells = CollectLeaves(Tree);
+            TestEqual("Leaves", Cells.Num(), 1);
+            TestEqual("Extend", Cells[0].Extend, FVector(Tree.GetBlockSize(3) / 2));
+            TestEqual("Center", Cells[0].Center, Location + FVector(Tree.GetBlockSize(3) / 2));
+        });
+
+        It("should merge freed buddies back into big blocks", [this, Location, Size]()
+        {
+            FSpatialBuddyTree Tree(Location, Size.X, 1.0f);
+            TArray<FVector> Results;
+            FVector Result;
+            while (Tree.Insert(FVector(Tree.GetBlockSize(3)), Result))
+            {
+                Results.Emplace(Result);
+            }
+            TestEqual("Full", Results.Num(), 512);
+            TestFalse("Whole", Tree.Insert(Size, Result));
+
+            bool Empty = false;
+            for (const FVector& Point : Results)
+            {
+                Empty = Tree.Remove(Point);
+            }
+            TestTrue("Empty", Empty);
+            TestTrue("Whole", Tree.Insert(Size, Result));
+            TestEqual("Center", Result, Location + Size / 2);
+        });
+
+        It("should find freed blocks across summary words", [this, Location, Size]()
+        {
+            FSpatialBuddyTree Tree(Location, Size.X, Size.X / 32);
+            TArray<FVector> Results;
+            FVector Result;
+            while (Tree.Insert(FVector(Tree.GetBlockSize(5)), Result))
+            {
+                Results.Emplace(Result);
+            }
+            TestEqual("Full", Results.Num(), 32768);
+
+            // Free scattered blocks from the back so the first free word is far from the start
+            TSet<FVector> Freed;
+            for (int32 Index = Results.Num() - 1; Index >= 0; Index -= 4099)
+            {
+                Tree.Remove(Results[Index]);
+                Freed.Add(Results[Index]);
+            }
+
+            int32 Refilled = 0;
+            while (Tree.Insert(FVector(Tree.GetBlockSize(5)), Result))
+            {
+                TestTrue("Freed", Freed.Contains(Result));
+                Refilled++;
+            }
+            TestEqual("Refilled", Refilled, Freed.Num());
+        });
+    });
+
+    Describe("FSpatialRoot handles", [this, Location, Size]()
+    {
+        It("should remove the allocation a handle points to", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            TArray<FVector> Results;
+            TArray<FSpatialHandle> Handles;
+            for (const FVector& Bounds : RandomBounds(6, 300, 1.0f, 20.0f))
+            {
+                FVector Result;
+                FSpatialHandle Handle;
+                if (Root.Insert(Bounds, Result, Handle))
+                {
+                    TestTrue("Valid", Handle.IsValid());
+                    Results.Emplace(Result);
+                    Handles.Emplace(Handle);
+                }
+            }
+
+            // Remove every other allocation by handle, the rest has to stay
+            for (int32 Index = 0; Index < Handles.Num(); Index += 2)
+            {
+                Root.Remove(Handles[Index]);
+            }
+
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            TestEqual("Leaves", Cells.Num(), Handles.Num() / 2);
+            for (int32 Index = 1; Index < Results.Num(); Index += 2)
+            {
+                const bool Found = Cells.ContainsByPredicate([&](const FTestCell& Cell) { return Cell.Center.Equals(Results[Index]); });
+                TestTrue("Kept", Found);
+            }
+
+            bool Empty = false;
+            for (int32 Index = 1; Index < Handles.Num(); Index += 2)
+            {
+                Empty = Root.Remove(Handles[Index]);
+            }
+            TestTrue("Empty", Empty);
+        });
+
+        It("should not hand out handles for failed inserts", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 2);
+            FVector Result;
+            FSpatialHandle Handle;
+            TestFalse("Insert", Root.Insert(Size * 2, Result, Handle));
+            TestFalse("Valid", Handle.IsValid());
+        });
+    });
+
+    Describe("FSpatialRoot::InsertBatch", [this, Location, Size]()
+    {
+        It("should place boxes without overlap and flag failures", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 2);
+            TArray<FVector> Bounds = RandomBounds(4, 300, 1.0f, 20.0f);
+            Bounds.Emplace(Size * 2);
+
+            TArray<FVector> Locations;
+            TBitArray<> Placed;
+            const int32 Count = Root.InsertBatch(Bounds, Locations, &Placed);
+            TestEqual("Locations", Locations.Num(), Bounds.Num());
+            TestFalse("Too big", Placed[Bounds.Num() - 1]);
+
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            TestEqual("Leaves", Cells.Num(), Count);
+            TestFalse("Overlap", AnyOverlap(Cells));
+
+            bool Empty = false;
+            for (int32 Index = 0; Index < Bounds.Num(); Index++)
+            {
+                if (Placed[Index])
+                {
+                    Empty = Root.Remove(Locations[Index]);
+                }
+            }
+            TestTrue("Empty", Empty);
+            TestEqual("Leaves", CollectLeaves(Root).Num(), 0);
+        });
+
+        It("should fill more volume than single inserts", [this, Location, Size]()
+        {
+            const TArray<FVector> Bounds = RandomBounds(5, 2000, 1.0f, 15.0f);
+            auto Volume = [&Bounds](const TBitArray<>& Placed)
+            {
+                double Sum = 0.0;
+                for (int32 Index = 0; Index < Bounds.Num(); Index++)
+                {
+                    Sum += Placed[Index] ? Bounds[Index].X * Bounds[Index].Y * Bounds[Index].Z : 0.0;
+                }
+                return Sum;
+            };
+
+            FSpatialRoot Single(Location, Size, 2);
+            TBitArray<> SinglePlaced(false, Bounds.Num());
+            for (int32 Index = 0; Index < Bounds.Num(); Index++)
+            {
+                FVector Result;
+                SinglePlaced[Index] = Single.Insert(Bounds[Index], Result);
+            }
+
+            FSpatialRoot Batch(Location, Size, 2);
+            TArray<FVector> Locations;
+            TBitArray<> BatchPlaced;
+            Batch.InsertBatch(Bounds, Locations, &BatchPlaced);
+
+            TestTrue("Fill", Volume(BatchPlaced) > Volume(SinglePlaced));
+        });
+    });
+
+    Describe("FSpatialRoot best-fit", [this, Location, Size]()
+    {
+        It("should place boxes without overlap", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            Root.SetPlacement(ESpatialPlacement::BestFit);
+
+            TArray<FVector> Results;
+            FRandomStream Stream(9);
+            for (const FVector& Bounds : RandomBounds(9, 1000, 1.0f, 20.0f))
+            {
+                FVector Result;
+                if (Root.Insert(Bounds, Result))
+                {
+                    Results.Emplace(Result);
+                }
+
+                if (Results.Num() > 0 && Stream.FRand() < 0.3f)
+                {
+                    const int32 Index = Stream.RandHelper(Results.Num());
+                    Root.Remove(Results[Index]);
+                    Results.RemoveAtSwap(Index);
+                }
+            }
+
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            TestEqual("Leaves", Cells.Num(), Results.Num());
+            TestFalse("Overlap", AnyOverlap(Cells));
+        });
+
+        It("should fill small holes before opening big cells", [this, Location, Size]()
+        {
+            for (const ESpatialPlacement Placement : { ESpatialPlacement::FirstFit, ESpatialPlacement::BestFit })
+            {
+                FSpatialRoot Root(Location, Size, 2);
+                Root.SetPlacement(Placement);
+
+                // Three quarter cubes and a tiny box next to them, then free the first cube
+                const FVector Big(45.0f), Tiny(1.0f);
+                FVector First, Result;
+                Root.Insert(Big, First);
+                Root.Insert(Big, Result);
+                Root.Insert(Big, Result);
+                Root.Insert(Tiny, Result);
+                Root.Remove(First);
+
+                // First-fit breaks up the freed cube, best-fit puts the tiny box next to the other one
+                Root.Insert(Tiny, Result);
+                TestTrue("Big", Root.Insert(Big, Result));
+                TestEqual("Reused", Result == First, Placement == ESpatialPlacement::BestFit);
+            }
+        });
+    });
+
+    Describe("FSpatialRoot rotation", [this, Location, Size]()
+    {
+        It("should place long boxes that only fit rotated", [this, Location, Size]()
+        {
+            // Top level slots are halves along Z
+            const FVector Bounds(10.0f, 10.0f, 60.0f);
+
+            FSpatialRoot Root(Location, Size, 2);
+            FVector Result;
+            FSpatialHandle Handle;
+            ESpatialOrientation Orientation;
+            TestFalse("Fixed", Root.Insert(Bounds, Result, Handle, Orientation));
+
+            Root.SetRotate(true);
+            TestTrue("Rotated", Root.Insert(Bounds, Result, Handle, Orientation));
+            TestNotEqual("Orientation", Orientation, ESpatialOrientation::XYZ);
+
+            const FVector Oriented = FSpatialRoot::Orient(Bounds, Orientation);
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            TestEqual("Leaves", Cells.Num(), 1);
+            TestTrue("Contained", Oriented.X < Cells[0].Extend.X * 2 && Oriented.Y < Cells[0].Extend.Y * 2 && Oriented.Z < Cells[0].Extend.Z * 2);
+            TestTrue("Removed", Root.Remove(Handle));
+        });
+
+        It("should place boxes without overlap and keep the given orientation on ties", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            Root.SetRotate(true);
+
+            FVector Result;
+            FSpatialHandle Handle;
+            ESpatialOrientation Orientation;
+            TestTrue("Cube", Root.Insert(FVector(5.0f), Result, Handle, Orientation));
+            TestEqual("Kept", Orientation, ESpatialOrientation::XYZ);
+
+            FRandomStream Stream(5);
+            int32 Placed = 1;
+            for (int32 Index = 0; Index < 400; Index++)
+            {
+                const FVector Bounds(Stream.FRandRange(1.0f, 8.0f), Stream.FRandRange(1.0f, 8.0f), Stream.FRandRange(10.0f, 40.0f));
+                if (Root.Insert(Bounds, Result, Handle, Orientation))
+                {
+                    Placed++;
+                }
+            }
+
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            TestEqual("Leaves", Cells.Num(), Placed);
+            TestFalse("Overlap", AnyOverlap(Cells));
+        });
+    });
+
+    Describe("FSpatialRoot growth", [this, Location]()
+    {
+        It("should grow on demand and keep earlier allocations valid", [this, Location]()
+        {
+            const FVector MaxSize(400.0f);
+            FSpatialRoot Root(Location, FVector(10.0f), 2);
+            Root.SetGrowable(true, MaxSize);
+
+            TArray<FVector> Results;
+            TArray<FSpatialHandle> Handles;
+            for (const FVector& Bounds : RandomBounds(6, 300, 1.0f, 20.0f))
+            {
+                FVector Result;
+                FSpatialHandle Handle;
+                if (Root.Insert(Bounds, Result, Handle))
+                {
+                    Results.Emplace(Result);
+                    Handles.Emplace(Handle);
+                }
+            }
+
+            const FVector Grown = Root.GetTree()->GetSize();
+            TestTrue("Grown", Grown.X > 10.0f && Grown.Y > 10.0f && Grown.Z > 10.0f);
+            TestTrue("Limited", Grown.X <= MaxSize.X && Grown.Y <= MaxSize.Y && Grown.Z <= MaxSize.Z);
+            TestEqual("Location", Root.GetTree()->GetLocation(), Location);
+
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            TestEqual("Leaves", Cells.Num(), Results.Num());
+            TestFalse("Overlap", AnyOverlap(Cells));
+
+            FSpatialStats Stats;
+            Root.GetStats(Stats);
+            TestEqual("Counted", Stats.LeafNum, Cells.Num());
+
+            // Handles made before the last growth are missing the top levels
+            bool Empty = false;
+            for (int32 Index = 0; Index < Handles.Num(); Index++)
+            {
+                TestTrue("Occupied", Root.IsOccupied(Results[Index]));
+                Empty = Root.Remove(Handles[Index]);
+                TestFalse("Removed", Root.IsOccupied(Results[Index]));
+            }
+            TestTrue("Empty", Empty);
+        });
+
+        It("should keep handles valid through a snapshot and more growth", [this, Location]()
+        {
+            FSpatialRoot Root(Location, FVector(10.0f), 2);
+            Root.SetGrowable(true, FVector(400.0f));
+
+            // Grows once before the handle is taken
+            FVector Result;
+            FSpatialHandle Handle;
+            TestTrue("Grow", Root.Insert(FVector(15.0f), Result, Handle));
+
+            TArray<uint8> Data;
+            Root.Save(Data);
+            FSpatialRoot Loaded(Location, FVector(10.0f), 2);
+            Loaded.SetGrowable(true, FVector(400.0f));
+            TestTrue("Load", Loaded.Load(Data));
+
+            // Needs more growth, which has to lift the older handle by the levels added after loading only
+            FVector Big;
+            TestTrue("Grow again", Loaded.Insert(FVector(60.0f), Big));
+            TestTrue("Occupied", Loaded.IsOccupied(Result));
+            Loaded.Remove(Handle);
+            TestFalse("Removed", Loaded.IsOccupied(Result));
+            TestTrue("Other", Loaded.IsOccupied(Big));
+        });
+
+        It("should fail once the size limit is reached", [this, Location]()
+        {
+            FSpatialRoot Root(Location, FVector(10.0f), 2);
+            Root.SetGrowable(true, FVector(40.0f));
+
+            FVector Result;
+            TestFalse("Too big", Root.Insert(FVector(50.0f), Result));
+            TestTrue("Fits", Root.Insert(FVector(15.0f), Result));
+
+            const FVector Grown = Root.GetTree()->GetSize();
+            TestTrue("Limited", Grown.X <= 40.0f && Grown.Y <= 40.0f && Grown.Z <= 40.0f);
+        });
+    });
+
+    Describe("FSpatialRoot slabs", [this, Location, Size]()
+    {
+        It("should not save empty reservations", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            const FVector Crate(4.0f);
+            Root.AddSlab(Crate);
+
+            // Reservation stays around after its only crate is gone
+            FVector Crated, Other;
+            TestTrue("Crate", Root.Insert(Crate, Crated));
+            Root.Remove(Crated);
+            TestTrue("Other", Root.Insert(FVector(30.0f), Other));
+
+            FSpatialStats Stats;
+            Root.Remove(Other);
+            Root.GetStats(Stats);
+            TestTrue("Reserved", Stats.BranchNum > 1);
+            TestTrue("Other again", Root.Insert(FVector(30.0f), Other));
+
+            TArray<uint8> Data;
+            Root.Save(Data);
+            FSpatialRoot Loaded(Location, Size, 3);
+            TestTrue("Load", Loaded.Load(Data));
+            TestTrue("Loaded", Loaded.IsOccupied(Other));
+
+            // Without slabs after loading, nothing keeps empty branches alive
+            TestTrue("Empty", Loaded.Remove(Other));
+            Loaded.GetStats(Stats);
+            TestEqual("Branches", Stats.BranchNum, 1);
+        });
+
+        It("should fill the same cells as regular placement", [this, Location, Size]()
+        {
+            const FVector Bounds(4.0f, 6.0f, 3.0f);
+            FSpatialRoot Regular(Location, Size, 3);
+            FSpatialRoot Slabbed(Location, Size, 3);
+            TestTrue("Slab", Slabbed.AddSlab(Bounds));
+            TestFalse("Too big", Slabbed.AddSlab(Size * 0.9f));
+
+            int32 RegularNum = 0, SlabbedNum = 0;
+            FVector Result;
+            while (Regular.Insert(Bounds, Result))
+            {
+                RegularNum++;
+            }
+            while (Slabbed.Insert(Bounds, Result))
+            {
+                SlabbedNum++;
+            }
+            TestEqual("Placed", SlabbedNum, RegularNum);
+            TestFalse("Overlap", AnyOverlap(CollectLeaves(Slabbed)));
+        });
+
+        It("should mix with regular inserts and removes", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            const FVector Crate(4.0f), Tile(9.0f, 9.0f, 2.0f);
+            Root.AddSlab(Crate);
+            Root.AddSlab(Tile);
+
+            FRandomStream Stream(8);
+            TArray<FVector> Results;
+            TArray<FSpatialHandle> Handles;
+            for (int32 Round = 0; Round < 4; Round++)
+            {
+                for (int32 Index = 0; Index < 300; Index++)
+                {
+                    const float Pick = Stream.FRand();
+                    const FVector Bounds = Pick < 0.4f ? Crate : Pick < 0.7f ? Tile : FVector(Stream.FRandRange(1.0f, 12.0f));
+
+                    FVector Result;
+                    FSpatialHandle Handle;
+                    if (Root.Insert(Bounds, Result, Handle))
+                    {
+                        Results.Emplace(Result);
+                        Handles.Emplace(Handle);
+                    }
+                }
+
+                // Free a share by handle and by point so slab slots come back both ways
+                for (int32 Index = Results.Num() - 1; Index >= 0; Index -= 3)
+                {
+                    if (Index % 2)
+                    {
+                        Root.Remove(Handles[Index]);
+                    }
+                    else
+                    {
+                        Root.Remove(Results[Index]);
+                    }
+                    TestFalse("Removed", Root.IsOccupied(Results[Index]));
+                    Results.RemoveAt(Index);
+                    Handles.RemoveAt(Index);
+                }
+            }
+
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            TestEqual("Leaves", Cells.Num(), Results.Num());
+            TestFalse("Overlap", AnyOverlap(Cells));
+
+            FSpatialStats Stats;
+            Root.GetStats(Stats);
+            TestEqual("Counted", Stats.LeafNum, Cells.Num());
+
+            for (const FSpatialHandle& Handle : Handles)
+            {
+                Root.Remove(Handle);
+            }
+            TestEqual("Empty", CollectLeaves(Root).Num(), 0);
+        });
+    });
+
+    Describe("FSpatialRoot::Compact", [this, Location, Size]()
+    {
+        // Churned tree with every other allocation freed again
+        auto MakeFragmented = [](FSpatialRoot& Root, TArray<FVector>& OutResults)
+        {
+            FRandomStream Stream(11);
+            for (const FVector& Bounds : RandomBounds(11, 1500, 1.0f, 15.0f))
+            {
+                FVector Result;
+                if (Root.Insert(Bounds, Result))
+                {
+                    OutResults.Emplace(Result);
+                }
+
+                if (OutResults.Num() > 0 && Stream.FRand() < 0.45f)
+                {
+                    const int32 Index = Stream.RandHelper(OutResults.Num());
+                    Root.Remove(OutResults[Index]);
+                    OutResults.RemoveAtSwap(Index);
+                }
+            }
+
+            for (int32 Index = OutResults.Num() - 1; Index >= 0; Index -= 2)
+            {
+                Root.Remove(OutResults[Index]);
+                OutResults.RemoveAtSwap(Index);
+            }
+        };
+
+        // Apply remap to allocations the caller knows about
+        auto Apply = [](TArray<FVector>& Results, const TArray<FSpatialRemap>& Remap)
+        {
+            for (const FSpatialRemap& Move : Remap)
+            {
+                for (FVector& Result : Results)
+                {
+                    if (Result == Move.From)
+                    {
+                        Result = Move.To;
+                        break;
+                    }
+                }
+            }
+        };
+
+        It("should keep every allocation and free up big cells", [this, Location, Size, MakeFragmented, Apply]()
+        {
+            FSpatialRoot Root(Location, Size, 2);
+            TArray<FVector> Results;
+            MakeFragmented(Root, Results);
+
+            TArray<uint8> Data;
+            Root.Save(Data);
+            FSpatialRoot Uncompacted(Location, Size, 2);
+            Uncompacted.Load(Data);
+
+            TArray<FSpatialRemap> Remap;
+            Root.Compact(Remap);
+            TestTrue("Moved", Remap.Num() > 0);
+            Apply(Results, Remap);
+
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            TestEqual("Leaves", Cells.Num(), Results.Num());
+            TestFalse("Overlap", AnyOverlap(Cells));
+            for (const FVector& Result : Results)
+            {
+                TestTrue("Remapped", Root.IsOccupied(Result));
+            }
+
+            const FVector Big(30.0f);
+            int32 Before = 0, After = 0;
+            FVector Result;
+            while (Uncompacted.Insert(Big, Result))
+            {
+                Before++;
+            }
+            while (Root.Insert(Big, Result))
+            {
+                After++;
+            }
+            TestTrue("Big", After > Before);
+        });
+
+        It("should hand out new handles for every allocation", [this, Location, Size, MakeFragmented]()
+        {
+            FSpatialRoot Root(Location, Size, 2);
+            TArray<FVector> Results;
+            MakeFragmented(Root, Results);
+
+            TArray<FSpatialRemap> Remap;
+            Root.Compact(Remap);
+            TestEqual("Visited", Remap.Num(), Results.Num());
+
+            bool Empty = false;
+            for (const FSpatialRemap& Move : Remap)
+            {
+                TestTrue("Occupied", Root.IsOccupied(Move.To));
+                Empty = Root.Remove(Move.Handle);
+                TestFalse("Removed", Root.IsOccupied(Move.To));
+            }
+            TestTrue("Empty", Empty);
+        });
+
+        It("should spread over several steps", [this, Location, Size, MakeFragmented, Apply]()
+        {
+            FSpatialRoot Root(Location, Size, 2);
+            TArray<FVector> Results;
+            MakeFragmented(Root, Results);
+
+            // Remove an allocation between steps, compaction has to skip it
+            FSpatialCompaction State;
+            TArray<FSpatialRemap> Remap;
+            int32 Steps = 0;
+            while (!Root.Compact(State, 0.0, Remap))
+            {
+                if (Steps++ == 0)
+                {
+                    Apply(Results, Remap);
+                    Remap.Reset();
+                    Root.Remove(Results.Pop());
+                }
+            }
+            Apply(Results, Remap);
+
+            TestTrue("Steps", Steps > 1);
+            TestTrue("Done", State.IsDone());
+            TestEqual("Leaves", CollectLeaves(Root).Num(), Results.Num());
+            for (const FVector& Result : Results)
+            {
+                TestTrue("Remapped", Root.IsOccupied(Result));
+            }
+        });
+    });
+
+    Describe("FSpatialRoot queries", [this, Location, Size]()
+    {
+        It("should find the same leaves as a full walk", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            TArray<FVector> Results;
+            for (const FVector& Bounds : RandomBounds(7, 400, 1.0f, 15.0f))
+            {
+                FVector Result;
+                if (Root.Insert(Bounds, Result))
+                {
+                    Results.Emplace(Result);
+                }
+            }
+
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            const FBox Box(FVector(20.0f, 10.0f, 30.0f), FVector(60.0f, 45.0f, 70.0f));
+            const FSphere Sphere(FVector(40.0f, 60.0f, 50.0f), 25.0f);
+
+            int32 BoxCount = 0, SphereCount = 0;
+            for (const FTestCell& Cell : Cells)
+            {
+                const FBox CellBox = FBox::BuildAABB(Cell.Center, Cell.Extend);
+                BoxCount += CellBox.Intersect(Box) ? 1 : 0;
+                SphereCount += FMath::SphereAABBIntersection(Sphere.Center, FMath::Square(Sphere.W), CellBox) ? 1 : 0;
+            }
+
+            TArray<FBox> Leaves;
+            Root.QueryBox(Box, Leaves);
+            TestEqual("Box", Leaves.Num(), BoxCount);
+
+            Leaves.Reset();
+            Root.QuerySphere(Sphere, Leaves);
+            TestEqual("Sphere", Leaves.Num(), SphereCount);
+
+            for (int32 Index = 0; Index < Results.Num(); Index += 2)
+            {
+                TestTrue("Occupied", Root.IsOccupied(Results[Index]));
+                Root.Remove(Results[Index]);
+                TestFalse("Freed", Root.IsOccupied(Results[Index]));
+            }
+        });
+
+        It("should find the nearest free cell with room", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 2);
+            const FVector Bounds = Size * 0.4f;
+
+            // Point is inside a free cell on an empty tree
+            FBox Cell;
+            const FVector Point(80.0f, 80.0f, 80.0f);
+            TestTrue("Empty", Root.FindNearestFree(Bounds, Point, Cell));
+            TestTrue("Inside", Cell.ComputeSquaredDistanceToPoint(Point) == 0.0);
+
+            TArray<FVector> Results;
+            FVector Result;
+            while (Root.Insert(Bounds, Result))
+            {
+                Results.Emplace(Result);
+            }
+            TestFalse("Full", Root.FindNearestFree(Bounds, Point, Cell));
+
+            // Only the freed cell is left
+            Root.Remove(Results[5]);
+            TestTrue("Freed", Root.FindNearestFree(Bounds, Point, Cell));
+            TestEqual("Cell", Cell.GetCenter(), Results[5]);
+        });
+    });
+
+    Describe("FSpatialRoot snapshots", [this, Location, Size]()
+    {
+        It("should load the same layout it saved", [this, Location, Size]()
+        {
+            const TArray<FVector> Bounds = RandomBounds(8, 20000, 0.5f, 6.0f);
+
+            // Replaying every insert is what snapshots replace
+            const double ReplayStart = FPlatformTime::Seconds();
+            FSpatialRoot Root(Location, Size, 3);
+            TArray<FVector> Results;
+            TArray<FSpatialHandle> Handles;
+            for (const FVector& Box : Bounds)
+            {
+                FVector Result;
+                FSpatialHandle Handle;
+                if (Root.Insert(Box, Result, Handle))
+                {
+                    Results.Emplace(Result);
+                    Handles.Emplace(Handle);
+                }
+            }
+            const double ReplayTime = FPlatformTime::Seconds() - ReplayStart;
+
+            TArray<uint8> Data;
+            Root.Save(Data);
+
+            const double LoadStart = FPlatformTime::Seconds();
+            FSpatialRoot Loaded(FVector::ZeroVector, FVector(1.0f), 2);
+            TestTrue("Load", Loaded.Load(Data));
+            const double LoadTime = FPlatformTime::Seconds() - LoadStart;
+
+            AddInfo(FString::Printf(TEXT("Replay %.2fms, load %.2fms, %d bytes for %d allocations"), ReplayTime * 1000.0, LoadTime * 1000.0, Data.Num(), Results.Num()));
+            TestTrue("Smaller than inputs", Data.Num() < Bounds.Num() * int32(sizeof(FVector)));
+
+            TArray<FTestCell> Expected, Actual;
+            Root.ForEach([&Expected](const FVector& Center, const FVector& Extend, bool IsLeaf) { Expected.Emplace(FTestCell{ Center, Extend }); });
+            Loaded.ForEach([&Actual](const FVector& Center, const FVector& Extend, bool IsLeaf) { Actual.Emplace(FTestCell{ Center, Extend }); });
+            TestEqual("Nodes", Actual.Num(), Expected.Num());
+            for (int32 Index = 0; Index < FMath::Min(Actual.Num(), Expected.Num()); Index++)
+            {
+                if (Actual[Index].Center != Expected[Index].Center || Actual[Index].Extend != Expected[Index].Extend)
+                {
+                    AddError(TEXT("Node mismatch"));
+                    break;
+                }
+            }
+
+            // Free space and handles carry over as well
+            FVector RootResult, LoadedResult;
+            const FVector Box(3.0f);
+            TestEqual("Insert", Loaded.Insert(Box, LoadedResult), Root.Insert(Box, RootResult));
+            TestEqual("Result", LoadedResult, RootResult);
+
+            Loaded.Remove(Handles[0]);
+            TestFalse("Handle", Loaded.IsOccupied(Results[0]));
+        });
+
+        It("should reject broken data", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 2);
+            FVector Result;
+            Root.Insert(FVector(10.0f), Result);
+
+            TArray<uint8> Data;
+            Root.Save(Data);
+
+            FSpatialRoot Loaded(Location, Size, 2);
+            TestFalse("Truncated", Loaded.Load(TArrayView<const uint8>(Data.GetData(), Data.Num() - 1)));
+            TestEqual("Empty", CollectLeaves(Loaded).Num(), 0);
+
+            // Slices follow magic and version
+            TArray<uint8> Huge = Data;
+            const int32 Slices = 1 << 30;
+            FMemory::Memcpy(Huge.GetData() + 2 * sizeof(uint32), &Slices, sizeof(int32));
+            TestFalse("Slices", Loaded.Load(Huge));
+
+            Data[0] ^= 0xFF;
+            TestFalse("Magic", Loaded.Load(Data));
+        });
+    });
+
+    Describe("FSpatialRoot::GetStats", [this, Location, Size]()
+    {
+        It("should match a full walk", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            TArray<FVector> Results;
+            int32 Failed = 0;
+            for (const FVector& Bounds : RandomBounds(9, 600, 1.0f, 30.0f))
+            {
+                FVector Result;
+                if (Root.Insert(Bounds, Result))
+                {
+                    Results.Emplace(Result);
+                }
+                else
+                {
+                    Failed++;
+                }
+            }
+            for (int32 Index = 0; Index < Results.Num(); Index += 4)
+            {
+                Root.Remove(Results[Index]);
+            }
+
+            int32 Leaves = 0, Branches = 0;
+            double Occupied = 0.0;
+            Root.ForEach([&](const FVector& Center, const FVector& Extend, bool IsLeaf)
+            {
+                if (IsLeaf)
+                {
+                    Leaves++;
+                    Occupied += Extend.X * Extend.Y * Extend.Z * 8.0;
+                }
+                else
+                {
+                    Branches++;
+                }
+            });
+
+            FSpatialStats Stats;
+            Root.GetStats(Stats);
+            TestEqual("Leaves", Stats.LeafNum, Leaves);
+            TestEqual("Branches", Stats.BranchNum, Branches);
+            TestEqual("Failed", Stats.FailedInserts, Failed);
+            TestEqual("Bytes", Stats.Bytes, Root.GetArena().GetUsedBytes());
+            TestTrue("Occupied", FMath::IsNearlyEqual(Stats.OccupiedVolume, Occupied, 1.0));
+            TestTrue("Free", FMath::IsNearlyEqual(Stats.FreeVolume, Size.X * Size.Y * Size.Z - Occupied, 1.0));
+            TestEqual("Largest", Stats.LargestFree, Root.GetTree()->GetSpace());
+            TestEqual("Root", Stats.BranchDepths[0], 1);
+
+            Root.Reset();
+            Root.GetStats(Stats);
+            TestEqual("Reset", Stats.LeafNum + Stats.BranchNum + Stats.FailedInserts, 1);
+        });
+
+        It("should stop splitting at the max depth", [this, Location]()
+        {
+            // Halving a million down to sub-unit boxes takes more levels than the counters cover
+            FSpatialRoot Root(Location, FVector(1000000.0f), 2);
+            for (int32 Index = 0; Index < 4; Index++)
+            {
+                FVector Result;
+                TestTrue("Insert", Root.Insert(FVector(0.01f), Result));
+            }
+
+            FSpatialStats Stats;
+            Root.GetStats(Stats);
+            TestEqual("Leaves", Stats.LeafNum, 4);
+            TestTrue("Depth", Stats.LeafDepths.Num() <= FSpatialBranch::MaxDepth + 1);
+            TestTrue("Deepest", Stats.LeafDepths.Last() > 0);
+        });
+    });
+
+    Describe("FSpatialRoot speculation", [this, Location, Size]()
+    {
+        // Insert a few boxes and remove every third one again
+        auto Churn = [](FSpatialRoot& Root, int32 Seed)
+        {
+            TArray<FSpatialHandle> Handles;
+            for (const FVector& Bounds : RandomBounds(Seed, 80, 1.0f, 15.0f))
+            {
+                FVector Result;
+                FSpatialHandle Handle;
+                if (Root.Insert(Bounds, Result, Handle))
+                {
+                    Handles.Emplace(Handle);
+                }
+            }
+            for (int32 Index = 0; Index < Handles.Num(); Index += 3)
+            {
+                Root.Remove(Handles[Index]);
+            }
+        };
+
+        It("should return to the exact same tree on discard", [this, Location, Size, Churn]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            Churn(Root, 1);
+
+            TArray<uint8> Before;
+            Root.Save(Before);
+            const SIZE_T Bytes = Root.GetArena().GetUsedBytes();
+            FSpatialStats BeforeStats;
+            Root.GetStats(BeforeStats);
+
+            Root.BeginSpeculation();
+            Churn(Root, 2);
+            Root.BeginSpeculation();
+            Churn(Root, 3);
+            Root.CommitSpeculation();
+            TestTrue("Speculating", Root.IsSpeculating());
+            Root.DiscardSpeculation();
+            TestFalse("Done", Root.IsSpeculating());
+
+            TArray<uint8> After;
+            Root.Save(After);
+            TestTrue("Layout", After == Before);
+            TestEqual("Bytes", Root.GetArena().GetUsedBytes(), Bytes);
+
+            FSpatialStats AfterStats;
+            Root.GetStats(AfterStats);
+            TestEqual("Leaves", AfterStats.LeafNum, BeforeStats.LeafNum);
+            TestEqual("Branches", AfterStats.BranchNum, BeforeStats.BranchNum);
+        });
+
+        It("should end up like a plain tree on commit", [this, Location, Size, Churn]()
+        {
+            FSpatialRoot Plain(Location, Size, 3);
+            Churn(Plain, 1);
+            Churn(Plain, 2);
+            Churn(Plain, 4);
+
+            FSpatialRoot Root(Location, Size, 3);
+            Churn(Root, 1);
+            Root.BeginSpeculation();
+            Churn(Root, 2);
+
+            // Thrown away attempt in between
+            Root.BeginSpeculation();
+            Churn(Root, 3);
+            Root.DiscardSpeculation();
+
+            Root.BeginSpeculation();
+            Churn(Root, 4);
+            Root.CommitSpeculation();
+            Root.CommitSpeculation();
+
+            TArray<uint8> PlainData, Data;
+            Plain.Save(PlainData);
+            Root.Save(Data);
+            TestTrue("Layout", Data == PlainData);
+            TestEqual("Bytes", Root.GetArena().GetUsedBytes(), Plain.GetArena().GetUsedBytes());
+
+            // Copies replaced the originals, the tree keeps working normally
+            Churn(Root, 5);
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            TestFalse("Overlap", AnyOverlap(Cells));
+        });
+    });
+
+    Describe("FSpatialRoot journal", [this, Location, Size]()
+    {
+        It("should let a mirror follow every change", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            Root.SetJournal(true);
+
+            TArray<FTestCell> Mirror;
+            auto Apply = [&Root, &Mirror]()
+            {
+                FSpatialChanges Changes;
+                Root.DrainChanges(Changes);
+                if (Changes.bCleared)
+                {
+                    Mirror.Reset();
+                }
+                for (const FVector& Center : Changes.RemovedCenters)
+                {
+                    Mirror.RemoveAllSwap([&Center](const FTestCell& Cell) { return Cell.Center == Center; });
+                }
+                for (int32 Index = 0; Index < Changes.AddedCenters.Num(); Index++)
+                {
+                    Mirror.Emplace(FTestCell{ Changes.AddedCenters[Index], Changes.AddedExtends[Index] });
+                }
+            };
+
+            auto Matches = [&Root, &Mirror]()
+            {
+                const TArray<FTestCell> Cells = CollectLeaves(Root);
+                if (Cells.Num() != Mirror.Num())
+                {
+                    return false;
+                }
+                for (const FTestCell& Cell : Cells)
+                {
+                    if (!Mirror.ContainsByPredicate([&Cell](const FTestCell& Other) { return Other.Center == Cell.Center && Other.Extend == Cell.Extend; }))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            };
+
+            FRandomStream Stream(10);
+            TArray<FVector> Results;
+            for (int32 Round = 0; Round < 6; Round++)
+            {
+                // Discarded attempts never show up, committed ones do
+                if (Round >= 3)
+                {
+                    Root.BeginSpeculation();
+                }
+
+                for (const FVector& Bounds : RandomBounds(Round, 100, 1.0f, 15.0f))
+                {
+                    FVector Result;
+                    if (Root.Insert(Bounds, Result))
+                    {
+                        Results.Emplace(Result);
+                    }
+
+                    // Some leaves come and go before a drain
+                    if (Results.Num() > 0 && Stream.FRand() < 0.3f)
+                    {
+                        const int32 Victim = Stream.RandRange(0, Results.Num() - 1);
+                        Root.Remove(Results[Victim]);
+                        Results.RemoveAtSwap(Victim);
+                    }
+                }
+
+                if (Round == 4)
+                {
+                    Root.DiscardSpeculation();
+                    Results.Reset();
+                    Root.ForEach([&Results](const FVector& Center, const FVector& Extend, bool IsLeaf)
+                    {
+                        if (IsLeaf)
+                        {
+                            Results.Emplace(Center);
+                        }
+                    });
+                }
+                else if (Round >= 3)
+                {
+                    Root.CommitSpeculation();
+                }
+
+                if (Round == 2)
+                {
+                    TArray<FSpatialRemap> Remap;
+                    Root.Compact(Remap);
+                    Results.Reset();
+                    Root.ForEach([&Results](const FVector& Center, const FVector& Extend, bool IsLeaf)
+                    {
+                        if (IsLeaf)
+                        {
+                            Results.Emplace(Center);
+                        }
+                    });
+                }
+
+                Apply();
+                TestTrue("Matches", Matches());
+            }
+
+            Root.Reset();
+            FSpatialChanges Changes;
+            Root.DrainChanges(Changes);
+            TestTrue("Cleared", Changes.bCleared);
+            TestEqual("Added", Changes.AddedCenters.Num(), 0);
+        });
+    });
+
+    Describe("FSpatialRoot concurrent mode", [this, Location, Size]()
+    {
+        It("should stay consistent under parallel inserts and removes", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            Root.SetConcurrent(true);
+
+            // Every worker churns its own allocations, kept ones are checked afterwards
+            constexpr int32 Workers = 8;
+            TArray<TArray<FVector>> Kept;
+            Kept.SetNum(Workers);
+            ParallelFor(Workers, [&Root, &Kept](int32 Worker)
+            {
+                FRandomStream Stream(Worker);
+                TArray<FVector>& Results = Kept[Worker];
+                for (const FVector& Bounds : RandomBounds(10 + Worker, 2000, 0.5f, 8.0f))
+                {
+                    FVector Result;
+                    if (Root.Insert(Bounds, Result))
+                    {
+                        Results.Emplace(Result);
+                    }
+
+                    if (Results.Num() > 0 && Stream.FRand() < 0.4f)
+                    {
+                        const int32 Index = Stream.RandHelper(Results.Num());
+                        Root.Remove(Results[Index]);
+                        Results.RemoveAtSwap(Index);
+                    }
+                }
+            });
+            Root.SetConcurrent(false);
+
+            TArray<FVector> All;
+            for (const TArray<FVector>& Results : Kept)
+            {
+                All.Append(Results);
+            }
+
+            const TArray<FTestCell> Cells = CollectLeaves(Root);
+            TestEqual("Leaves", Cells.Num(), All.Num());
+            TestFalse("Overlap", AnyOverlap(Cells));
+
+            FSpatialStats Stats;
+            Root.GetStats(Stats);
+            TestEqual("Counted", Stats.LeafNum, Cells.Num());
+            for (const FVector& Result : All)
+            {
+                const bool Found = Cells.ContainsByPredicate([&](const FTestCell& Cell) { return Cell.Center.Equals(Result); });
+                TestTrue("Kept", Found);
+            }
+
+            bool Empty = false;
+            for (const FVector& Result : All)
+            {
+                Empty = Root.Remove(Result);
+            }
+            TestTrue("Empty", Empty);
+        });
+    });
+
+    Describe("FSpatialAtlasTree", [this]()
+    {
+        It("should pack rects inside the atlas without overlap", [this]()
+        {
+            const FVector2D AtlasSize(1024.0f, 1024.0f);
+            FSpatialAtlasTree Atlas(FVector2D::ZeroVector, AtlasSize, 2);
+
+            FRandomStream Stream(12);
+            TArray<FVector2D> Results;
+            for (int32 Index = 0; Index < 500; Index++)
+            {
+                FVector2D Result;
+                const FVector2D Bounds(Stream.FRandRange(4.0f, 128.0f), Stream.FRandRange(4.0f, 128.0f));
+                if (Atlas.Insert(Bounds, Result))
+                {
+                    TestTrue("Inside", Result.X > 0.0f && Result.Y > 0.0f && Result.X < AtlasSize.X && Result.Y < AtlasSize.Y);
+                    Results.Emplace(Result);
+                }
+            }
+
+            TArray<FVector2D> Centers, Extends;
+            Atlas.ForEach([&](const FVector2D& Center, const FVector2D& Extend, bool IsLeaf)
+            {
+                if (IsLeaf)
+                {
+                    Centers.Emplace(Center);
+                    Extends.Emplace(Extend);
+                }
+            });
+            TestEqual("Leaves", Centers.Num(), Results.Num());
+
+            bool Overlap = false;
+            for (int32 I = 0; I < Centers.Num(); I++)
+            {
+                for (int32 J = I + 1; J < Centers.Num(); J++)
+                {
+                    const FVector2D Delta = (Centers[I] - Centers[J]).GetAbs();
+                    const FVector2D Reach = Extends[I] + Extends[J] - FVector2D(KINDA_SMALL_NUMBER, KINDA_SMALL_NUMBER);
+                    Overlap |= Delta.X < Reach.X && Delta.Y < Reach.Y;
+                }
+            }
+            TestFalse("Overlap", Overlap);
+
+            bool Empty = false;
+            for (const FVector2D& Result : Results)
+            {
+                Empty = Atlas.Remove(Result);
+            }
+            TestTrue("Empty", Empty);
+            TestEqual("Nodes", Atlas.GetNodeNum(), 1);
+        });
+    });
+
+    Describe("FSpatialFlatTree", [this, Location, Size]()
+    {
+        It("should place like FSpatialRoot", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            FSpatialFlatTree Flat(Location, Size, 3);
+            const TArray<FVector> Bounds = RandomBounds(3, 400, 1.0f, 25.0f);
+            for (int32 Index = 0; Index < Bounds.Num(); Index++)
+            {
+                FVector RootResult, FlatResult;
+                const bool RootSuccess = Root.Insert(Bounds[Index], RootResult);
+                TestEqual("Success", Flat.Insert(Bounds[Index], FlatResult), RootSuccess);
+                if (RootSuccess)
+                {
+                    TestEqual("Result", FlatResult, RootResult);
+                }
+
+                // Churn a bit so removal paths are compared as well
+                if (RootSuccess && Index % 3 == 0)
+                {
+                    TestEqual("Remove", Flat.Remove(FlatResult), Root.Remove(RootResult));
+                }
+            }
+        });
+    });
+
+    Describe("FSpatialGridTree", [this]()
+    {
+        It("should place boxes on whole cells without overlap", [this]()
+        {
+            // Sizes that don't divide by the slice count
+            const FIntVector GridSize(100, 77, 130);
+            FSpatialGridTree Grid(FIntVector::ZeroValue, GridSize, 3);
+
+            FRandomStream Stream(13);
+            TArray<FIntVector> Results, Bounds;
+            for (int32 Index = 0; Index < 500; Index++)
+            {
+                FIntVector Result;
+                const FIntVector Box(Stream.RandRange(1, 20), Stream.RandRange(1, 20), Stream.RandRange(1, 20));
+                if (Grid.Insert(Box, Result))
+                {
+                    Results.Emplace(Result);
+                    Bounds.Emplace(Box);
+                }
+            }
+            TestTrue("Placed", Results.Num() > 0);
+
+            TArray<FIntVector> Locations, Sizes;
+            Grid.ForEach([&](const FIntVector& Location, const FIntVector& Size, bool IsLeaf)
+            {
+                if (IsLeaf)
+                {
+                    Locations.Emplace(Location);
+                    Sizes.Emplace(Size);
+                }
+            });
+            TestEqual("Leaves", Locations.Num(), Results.Num());
+
+            // Every box starts at a leaf that holds it
+            bool Fits = true;
+            for (int32 Index = 0; Index < Results.Num(); Index++)
+            {
+                const int32 Leaf = Locations.IndexOfByKey(Results[Index]);
+                Fits &= Leaf != INDEX_NONE;
+                for (int32 Axis = 0; Axis < 3 && Leaf != INDEX_NONE; Axis++)
+                {
+                    Fits &= Bounds[Index][Axis] <= Sizes[Leaf][Axis];
+                    Fits &= Locations[Leaf][Axis] >= 0 && Locations[Leaf][Axis] + Sizes[Leaf][Axis] <= GridSize[Axis];
+                }
+            }
+            TestTrue("Fits", Fits);
+
+            bool Overlap = false;
+            for (int32 I = 0; I < Locations.Num(); I++)
+            {
+                for (int32 J = I + 1; J < Locations.Num(); J++)
+                {
+                    bool Intersect = true;
+                    for (int32 Axis = 0; Axis < 3; Axis++)
+                    {
+                        Intersect &= Locations[I][Axis] < Locations[J][Axis] + Sizes[J][Axis] && Locations[J][Axis] < Locations[I][Axis] + Sizes[I][Axis];
+                    }
+                    Overlap |= Intersect;
+                }
+            }
+            TestFalse("Overlap", Overlap);
+
+            bool Empty = false;
+            for (const FIntVector& Result : Results)
+            {
+                Empty = Grid.Remove(Result);
+            }
+            TestTrue("Empty", Empty);
+            TestEqual("Nodes", Grid.GetNodeNum(), 1);
+        });
+
+        It("should fill the whole volume with exact boxes", [this]()
+        {
+            // Two slices of a 64 cube end in 8 cell leaves after three levels per axis
+            FSpatialGridTree Grid(FIntVector::ZeroValue, FIntVector(64), 2);
+            int32 Placed = 0;
+            FIntVector Result;
+            while (Grid.Insert(FIntVector(8), Result))
+            {
+                Placed++;
+            }
+            TestEqual("Placed", Placed, 512);
+        });
+    });
+}
@@ -0,0 +1,517 @@
+#include "Structures/SpatialTree.h"
+#include "Structures/SpatialFlatTree.h"
+#include "Structures/SpatialBuddyTree.h"
+#include "Structures/SpatialGridTree.h"
+
+#include "Misc/AutomationTest.h"
+
+namespace SpatialTreePerf
+{
+    enum class EDistribution : uint8
+    {
+        // Every size equally likely
+        Uniform,
+
+        // Mostly small boxes, few big ones
+        Skewed,
+
+        // Small and big boxes, nothing in between
+        Bimodal
+    };
+
+    const TCHAR* GetDistributionName(EDistribution Distribution)
+    {
+        switch (Distribution)
+        {
+        case EDistribution::Uniform: return TEXT("uniform");
+        case EDistribution::Skewed: return TEXT("skewed");
+        case EDistribution::Bimodal: return TEXT("bimodal");
+        default: return TEXT("");
+        }
+    }
+
+    FVector SampleBounds(FRandomStream& Stream, EDistribution Distribution, float Min, float Max)
+    {
+        float Extent = 0.0f;
+        switch (Distribution)
+        {
+        case EDistribution::Skewed: Extent = Min + (Max - Min) * FMath::Pow(Stream.FRand(), 4.0f); break;
+        case EDistribution::Bimodal: Extent = Stream.FRand() < 0.8f ? Stream.FRandRange(Min, Min * 4.0f) : Stream.FRandRange(Max * 0.7f, Max); break;
+        default: Extent = Stream.FRandRange(Min, Max); break;
+        }
+
+        // Vary the aspect ratio a bit so boxes aren't all cubes
+        return FVector(Extent,
+            FMath::Clamp(Extent * Stream.FRandRange(0.5f, 1.5f), Min, Max),
+            FMath::Clamp(Extent * Stream.FRandRange(0.5f, 1.5f), Min, Max));
+    }
+
+    struct FRun
+    {
+        // Successful and failed inserts per second while filling up
+        double InsertsPerSecond = 0.0;
+
+        // Average time per remove during churn
+        double RemoveMicroseconds = 0.0;
+
+        // Average time per insert during churn
+        double ChurnInsertMicroseconds = 0.0;
+
+        // Allocations and tree shape after churn
+        int32 Allocations = 0;
+        int32 Nodes = 0;
+        SIZE_T Bytes = 0;
+
+        // Placed box volume over tree volume after churn
+        double Fill = 0.0;
+    };
+
+    // Fill the tree, then remove and reinsert a share of the allocations for a few rounds
+    FRun RunChurn(FSpatialRoot& Root, EDistribution Distribution, int32 Seed, int32 Attempts, int32 Rounds)
+    {
+        FRandomStream Stream(Seed);
+        TArray<FVector> Bounds;
+        for (int32 Index = 0; Index < Attempts; Index++)
+        {
+            Bounds.Emplace(SampleBounds(Stream, Distribution, 0.5f, 20.0f));
+        }
+
+        TArray<FVector> Results;
+        TArray<double> Volumes;
+
+        FRun Run;
+        const double FillStart = FPlatformTime::Seconds();
+        for (const FVector& Box : Bounds)
+        {
+            FVector Result;
+            if (Root.Insert(Box, Result))
+            {
+                Results.Emplace(Result);
+                Volumes.Emplace(Box.X * Box.Y * Box.Z);
+            }
+        }
+        Run.InsertsPerSecond = Attempts / FMath::Max(FPlatformTime::Seconds() - FillStart, 1e-9);
+
+        double RemoveTime = 0.0, InsertTime = 0.0;
+        int32 Removes = 0, Inserts = 0;
+        for (int32 Round = 0; Round < Rounds; Round++)
+        {
+            // Pick victims up front so only removal is timed
+            TArray<int32> Victims;
+            for (int32 Index = 0; Index < Results.Num(); Index++)
+            {
+                if (Stream.FRand() < 0.2f)
+                {
+                    Victims.Emplace(Index);
+                }
+            }
+
+            const double RemoveStart = FPlatformTime::Seconds();
+            for (int32 Victim : Victims)
+            {
+                Root.Remove(Results[Victim]);
+            }
+            RemoveTime += FPlatformTime::Seconds() - RemoveStart;
+            Removes += Victims.Num();
+
+            for (int32 Index = Victims.Num() - 1; Index >= 0; Index--)
+            {
+                Results.RemoveAtSwap(Victims[Index]);
+                Volumes.RemoveAtSwap(Victims[Index]);
+            }
+
+            Bounds.Reset();
+            for (int32 Index = 0; Index < Victims.Num(); Index++)
+            {
+                Bounds.Emplace(SampleBounds(Stream, Distribution, 0.5f, 20.0f));
+            }
+
+            const double InsertStart = FPlatformTime::Seconds();
+            for (const FVector& Box : Bounds)
+            {
+                FVector Result;
+                if (Root.Insert(Box, Result))
+                {
+                    Results.Emplace(Result);
+                    Volumes.Emplace(Box.X * Box.Y * Box.Z);
+                }
+            }
+            InsertTime += FPlatformTime::Seconds() - InsertStart;
+            Inserts += Bounds.Num();
+        }
+        Run.RemoveMicroseconds = RemoveTime * 1000000.0 / FMath::Max(Removes, 1);
+        Run.ChurnInsertMicroseconds = InsertTime * 1000000.0 / FMath::Max(Inserts, 1);
+
+        Run.Allocations = Results.Num();
+        Root.ForEach([&Run](const FVector& Center, const FVector& Extend, bool IsLeaf) { Run.Nodes++; });
+        Run.Bytes = Root.GetArena().GetUsedBytes();
+
+        double Volume = 0.0;
+        for (double BoxVolume : Volumes)
+        {
+            Volume += BoxVolume;
+        }
+        const FVector Size = Root.GetTree()->GetSize();
+        Run.Fill = Volume / (Size.X * Size.Y * Size.Z);
+        return Run;
+    }
+
+    FString Summarize(const FRun& Run)
+    {
+        return FString::Printf(TEXT("%.0f inserts/s, %.3fus/insert and %.3fus/remove in churn, %d allocations, %d nodes, %llu bytes, %.2f%% fill"),
+            Run.InsertsPerSecond, Run.ChurnInsertMicroseconds, Run.RemoveMicroseconds, Run.Allocations, Run.Nodes, uint64(Run.Bytes), Run.Fill * 100.0);
+    }
+}
+
+DEFINE_SPEC(SpatialTreePerfSpec, "Angry.SpatialTreePerfSpec", EAutomationTestFlags::PerfFilter | EAutomationTestFlags::ApplicationContextMask)
+void SpatialTreePerfSpec::Define()
+{
+    using namespace SpatialTreePerf;
+
+    const FVector Location = FVector::ZeroVector;
+    const FVector Size = FVector(1000.0f);
+
+    Describe("Distributions", [this, Location, Size]()
+    {
+        It("should report uniform, skewed and bimodal sizes", [this, Location, Size]()
+        {
+            for (EDistribution Distribution : { EDistribution::Uniform, EDistribution::Skewed, EDistribution::Bimodal })
+            {
+                for (ESpatialPlacement Placement : { ESpatialPlacement::FirstFit, ESpatialPlacement::BestFit })
+                {
+                    FSpatialRoot Root(Location, Size, 3);
+                    Root.SetPlacement(Placement);
+                    const FRun Result = RunChurn(Root, Distribution, 1, 50000, 20);
+                    AddInfo(FString::Printf(TEXT("%s %s: %s"), GetDistributionName(Distribution),
+                        Placement == ESpatialPlacement::BestFit ? TEXT("best-fit") : TEXT("first-fit"), *Summarize(Result)));
+                }
+            }
+        });
+    });
+
+    Describe("Rotation", [this, Location, Size]()
+    {
+        It("should report long boxes with and without rotation", [this, Location, Size]()
+        {
+            FRandomStream Stream(5);
+            TArray<FVector> Bounds;
+            for (int32 Index = 0; Index < 50000; Index++)
+            {
+                // Long along a random axis
+                FVector Box(Stream.FRandRange(1.0f, 10.0f), Stream.FRandRange(1.0f, 10.0f), Stream.FRandRange(1.0f, 10.0f));
+                Box[Stream.RandRange(0, 2)] *= 8.0f;
+                Bounds.Emplace(Box);
+            }
+
+            for (bool bRotate : { false, true })
+            {
+                FSpatialRoot Root(Location, Size, 3);
+                Root.SetRotate(bRotate);
+
+                double Volume = 0.0;
+                const double Start = FPlatformTime::Seconds();
+                for (const FVector& Box : Bounds)
+                {
+                    FVector Result;
+                    if (Root.Insert(Box, Result))
+                    {
+                        Volume += Box.X * Box.Y * Box.Z;
+                    }
+                }
+                const double Time = FPlatformTime::Seconds() - Start;
+
+                FSpatialStats Stats;
+                Root.GetStats(Stats);
+                AddInfo(FString::Printf(TEXT("%s: %.3fus/insert, %d failed, %llu bytes, %.2f%% fill"), bRotate ? TEXT("rotated") : TEXT("fixed"),
+                    Time * 1000000.0 / Bounds.Num(), Stats.FailedInserts, uint64(Stats.Bytes), Volume / (Size.X * Size.Y * Size.Z) * 100.0));
+            }
+        });
+    });
+
+    Describe("Growth", [this, Location, Size]()
+    {
+        It("should report growing from a small root against a big fixed one", [this, Location, Size]()
+        {
+            for (int32 Count : { 100, 1000, 10000 })
+            {
+                FRandomStream Stream(6);
+                TArray<FVector> Bounds;
+                for (int32 Index = 0; Index < Count; Index++)
+                {
+                    Bounds.Emplace(SampleBounds(Stream, EDistribution::Uniform, 0.5f, 20.0f));
+                }
+
+                FSpatialRoot Fixed(Location, Size * 8, 2);
+                FSpatialRoot Growing(Location, FVector(20.0f), 2);
+                Growing.SetGrowable(true, Size * 8);
+
+                int32 FixedPlaced = 0, GrowingPlaced = 0;
+                const double FixedStart = FPlatformTime::Seconds();
+                for (const FVector& Box : Bounds)
+                {
+                    FVector Result;
+                    FixedPlaced += Fixed.Insert(Box, Result) ? 1 : 0;
+                }
+                const double FixedTime = FPlatformTime::Seconds() - FixedStart;
+
+                const double GrowingStart = FPlatformTime::Seconds();
+                for (const FVector& Box : Bounds)
+                {
+                    FVector Result;
+                    GrowingPlaced += Growing.Insert(Box, Result) ? 1 : 0;
+                }
+                const double GrowingTime = FPlatformTime::Seconds() - GrowingStart;
+
+                AddInfo(FString::Printf(TEXT("%d boxes: fixed %d placed, %.3fus/insert, %llu bytes; growing %d placed, %.3fus/insert, %llu bytes, size %.0f x %.0f x %.0f"),
+                    Count, FixedPlaced, FixedTime * 1000000.0 / Count, uint64(Fixed.GetArena().GetUsedBytes()),
+                    GrowingPlaced, GrowingTime * 1000000.0 / Count, uint64(Growing.GetArena().GetUsedBytes()),
+                    Growing.GetTree()->GetSize().X, Growing.GetTree()->GetSize().Y, Growing.GetTree()->GetSize().Z));
+            }
+        });
+    });
+
+    Describe("Slabs", [this, Location, Size]()
+    {
+        It("should report a few exact sizes with and without slabs", [this, Location, Size]()
+        {
+            const FVector Classes[] = { FVector(2.0f), FVector(4.0f, 4.0f, 1.0f), FVector(6.0f, 3.0f, 3.0f), FVector(10.0f) };
+
+            FRandomStream Stream(7);
+            TArray<FVector> Bounds;
+            for (int32 Index = 0; Index < 100000; Index++)
+            {
+                Bounds.Emplace(Classes[Stream.RandRange(0, 3)]);
+            }
+
+            for (bool bSlabs : { false, true })
+            {
+                FSpatialRoot Root(Location, Size, 3);
+                if (bSlabs)
+                {
+                    for (const FVector& Class : Classes)
+                    {
+                        Root.AddSlab(Class);
+                    }
+                }
+
+                TArray<FVector> Results;
+                const double Start = FPlatformTime::Seconds();
+                for (int32 Index = 0; Index < Bounds.Num(); Index++)
+                {
+                    FVector Result;
+                    if (Root.Insert(Bounds[Index], Result))
+                    {
+                        Results.Emplace(Result);
+                    }
+
+                    if (Index % 4 == 3 && Results.Num() > 0)
+                    {
+                        Root.Remove(Results.Pop());
+                    }
+                }
+                const double Time = FPlatformTime::Seconds() - Start;
+
+                FSpatialStats Stats;
+                Root.GetStats(Stats);
+                AddInfo(FString::Printf(TEXT("%s: %d placed, %.3fus/op, %d nodes, %llu bytes"), bSlabs ? TEXT("slabs") : TEXT("regular"),
+                    Results.Num(), Time * 1000000.0 / Bounds.Num(), Stats.LeafNum + Stats.BranchNum, uint64(Stats.Bytes)));
+            }
+        });
+    });
+
+    Describe("Speculation", [this, Location, Size]()
+    {
+        It("should report throwaway attempts against rebuilding from a snapshot", [this, Location, Size]()
+        {
+            FSpatialRoot Root(Location, Size, 3);
+            RunChurn(Root, EDistribution::Uniform, 8, 20000, 0);
+
+            TArray<uint8> Data;
+            Root.Save(Data);
+
+            FRandomStream Stream(8);
+            TArray<FVector> Bounds;
+            for (int32 Index = 0; Index < 20; Index++)
+            {
+                Bounds.Emplace(SampleBounds(Stream, EDistribution::Uniform, 0.5f, 20.0f));
+            }
+
+            const int32 Attempts = 200;
+            const double SnapshotStart = FPlatformTime::Seconds();
+            for (int32 Attempt = 0; Attempt < Attempts; Attempt++)
+            {
+                FSpatialRoot Copy(Location, Size, 3);
+                Copy.Load(Data);
+                for (const FVector& Box : Bounds)
+                {
+                    FVector Result;
+                    Copy.Insert(Box, Result);
+                }
+            }
+            const double SnapshotTime = FPlatformTime::Seconds() - SnapshotStart;
+
+            const double SpeculationStart = FPlatformTime::Seconds();
+            for (int32 Attempt = 0; Attempt < Attempts; Attempt++)
+            {
+                Root.BeginSpeculation();
+                for (const FVector& Box : Bounds)
+                {
+                    FVector Result;
+                    Root.Insert(Box, Result);
+                }
+                Root.DiscardSpeculation();
+            }
+            const double SpeculationTime = FPlatformTime::Seconds() - SpeculationStart;
+
+            AddInfo(FString::Printf(TEXT("%d boxes per attempt: load %.1fus/attempt, speculation %.1fus/attempt"),
+                Bounds.Num(), SnapshotTime * 1000000.0 / Attempts, SpeculationTime * 1000000.0 / Attempts));
+        });
+    });
+
+    Describe("Atlas", [this]()
+    {
+        It("should report 2D packing", [this]()
+        {
+            FRandomStream Stream(3);
+            TArray<FVector2D> Rects;
+            for (int32 Index = 0; Index < 100000; Index++)
+            {
+                Rects.Emplace(FVector2D(Stream.FRandRange(2.0f, 64.0f), Stream.FRandRange(2.0f, 64.0f)));
+            }
+
+            for (int32 Slices : { 2, 4 })
+            {
+                FSpatialAtlasTree Atlas(FVector2D::ZeroVector, FVector2D(4096.0f, 4096.0f), Slices);
+                int32 Placed = 0;
+                double Area = 0.0;
+                const double Start = FPlatformTime::Seconds();
+                for (const FVector2D& Rect : Rects)
+                {
+                    FVector2D Result;
+                    if (Atlas.Insert(Rect, Result))
+                    {
+                        Area += Rect.X * Rect.Y;
+                        Placed++;
+                    }
+                }
+                const double Time = FPlatformTime::Seconds() - Start;
+
+                // 3D nodes carry a third component in all three vectors
+                AddInfo(FString::Printf(TEXT("%d slices: %d placed, %.3fus/insert, %d nodes, %d bytes per node (3D: %d), %.2f%% fill"),
+                    Slices, Placed, Time * 1000000.0 / Rects.Num(), Atlas.GetNodeNum(), int32(sizeof(FSpatialAtlasNode)), int32(sizeof(FSpatialFlatNode)),
+                    Area / (4096.0 * 4096.0) * 100.0));
+            }
+        });
+    });
+
+    Describe("Bricks", [this]()
+    {
+        It("should report power-of-two cubes for buddy and slice trees", [this]()
+        {
+            // Brick edge lengths from 1 to 32 in a 128 cube
+            FRandomStream Stream(4);
+            TArray<FVector> Bricks;
+            for (int32 Index = 0; Index < 50000; Index++)
+            {
+                Bricks.Emplace(FVector(float(1 << FMath::Min(Stream.RandRange(0, 5), Stream.RandRange(0, 5)))));
+            }
+
+            auto Churn = [&Bricks](auto& Tree, const TCHAR* Name)
+            {
+                TArray<FVector> Results;
+                const double Start = FPlatformTime::Seconds();
+                for (int32 Index = 0; Index < Bricks.Num(); Index++)
+                {
+                    FVector Result;
+                    if (Tree.Insert(Bricks[Index], Result))
+                    {
+                        Results.Emplace(Result);
+                    }
+
+                    // Free every third brick so merging gets exercised
+                    if (Index % 3 == 2 && Results.Num() > 0)
+                    {
+                        Tree.Remove(Results.Pop());
+                    }
+                }
+                const double Time = FPlatformTime::Seconds() - Start;
+                return FString::Printf(TEXT("%s: %d placed, %.3fus/op"), Name, Results.Num(), Time * 1000000.0 / Bricks.Num());
+            };
+
+            FSpatialBuddyTree Buddy(FVector::ZeroVector, 128.0f, 1.0f);
+            AddInfo(Churn(Buddy, TEXT("buddy")));
+
+            // Slightly oversized so power-of-two bricks fit the strict space test
+            FSpatialRoot Root(FVector::ZeroVector, FVector(128.0f + KINDA_SMALL_NUMBER), 2);
+            AddInfo(Churn(Root, TEXT("slices")));
+        });
+    });
+
+    Describe("Grid", [this]()
+    {
+        It("should report integer grid placement against the flat tree", [this]()
+        {
+            FRandomStream Stream(5);
+            TArray<FIntVector> Boxes;
+            for (int32 Index = 0; Index < 100000; Index++)
+            {
+                Boxes.Emplace(FIntVector(Stream.RandRange(1, 24), Stream.RandRange(1, 24), Stream.RandRange(1, 24)));
+            }
+
+            for (int32 Slices : { 2, 4, 8 })
+            {
+                FSpatialGridTree Grid(FIntVector::ZeroValue, FIntVector(1024), Slices);
+                TArray<FIntVector> GridResults;
+                const double GridStart = FPlatformTime::Seconds();
+                for (int32 Index = 0; Index < Boxes.Num(); Index++)
+                {
+                    FIntVector Result;
+                    if (Grid.Insert(Boxes[Index], Result))
+                    {
+                        GridResults.Emplace(Result);
+                    }
+                    if (Index % 3 == 2 && GridResults.Num() > 0)
+                    {
+                        Grid.Remove(GridResults.Pop());
+                    }
+                }
+                const double GridTime = FPlatformTime::Seconds() - GridStart;
+
+                // Same boxes in world units, slightly shrunk for the strict space test
+                FSpatialFlatTree Flat(FVector::ZeroVector, FVector(1024.0f), Slices);
+                TArray<FVector> FlatResults;
+                const double FlatStart = FPlatformTime::Seconds();
+                for (int32 Index = 0; Index < Boxes.Num(); Index++)
+                {
+                    FVector Result;
+                    const FVector Box(Boxes[Index].X - 0.5f, Boxes[Index].Y - 0.5f, Boxes[Index].Z - 0.5f);
+                    if (Flat.Insert(Box, Result))
+                    {
+                        FlatResults.Emplace(Result);
+                    }
+                    if (Index % 3 == 2 && FlatResults.Num() > 0)
+                    {
+                        Flat.Remove(FlatResults.Pop());
+                    }
+                }
+                const double FlatTime = FPlatformTime::Seconds() - FlatStart;
+
+                AddInfo(FString::Printf(TEXT("%d slices: grid %d placed, %.3fus/op, flat %d placed, %.3fus/op"),
+                    Slices, GridResults.Num(), GridTime * 1000000.0 / Boxes.Num(), FlatResults.Num(), FlatTime * 1000000.0 / Boxes.Num()));
+            }
+        });
+    });
+
+    Describe("Slices", [this, Location, Size]()
+    {
+        It("should report every slice count", [this, Location, Size]()
+        {
+            for (int32 Slices : { 2, 3, 4, 6, 8 })
+            {
+                FSpatialRoot Root(Location, Size, Slices);
+                const FRun Result = RunChurn(Root, EDistribution::Uniform, 2, 50000, 20);
+                AddInfo(FString::Printf(TEXT("%d slices: %s"), Slices, *Summarize(Result)));
+            }
+        });
+    });
+}
@@ -31,6 +31,105 @@ struct ANGRYUTILITY_API FGMMDistribution
 		float Pi;
 };
 
+/**
+ * Points laid out per axis, padded with zeros to a multiple of four for batched evaluation.
+ */
+struct ANGRYUTILITY_API FGMMPoints
+{
+	FGMMPoints(const TArray<FVector>& Points);
+
+	/** Number of points without padding */
+	int32 Num;
+
+	/** Coordinates per axis */
+	TArray<float> X;
+	TArray<float> Y;
+	TArray<float> Z;
+};
+
+/**
+ * Distribution prepared for evaluation, the covariance is factorized once instead of per point.
+ */
+struct ANGRYUTILITY_API FGMMFactor
+{
+	FGMMFactor(const FGMMDistribution& Distribution, float Weight);
+
+	/** Weighted density at a point */
+	float Pdf(const FVector& X) const;
+
+	/** Squared mahalanobis distance to a point */
+	float Distance(const FVector& X) const;
+
+	/** Lower and upper bound of the squared mahalanobis distance over a box */
+	void Distance(const FVector& Min, const FVector& Max, float& OutMin, float& OutMax) const;
+
+	/** Weighted density for a range of points, starting at a multiple of four and rounded up to one */
+	void Pdf(const FGMMPoints& Points, int32 First, int32 Num, float* Out) const;
+
+	/** Mean position */
+	float MuX, MuY, MuZ;
+
+	/** Cholesky factor of the covariance with inverted diagonal, identity if not positive definite */
+	float LXY, LXZ, LYZ;
+	float InvLXX, InvLYY, InvLZZ;
+
+	/** Log of weight over normalisation */
+	float LogScale;
+
+	/** Degenerate covariances have zero density */
+	bool bDegenerate;
+};
+
+/**
+ * Weighted sums over points for one distribution, taken relative to a reference point to keep precision.
+ */
+struct ANGRYUTILITY_API FGMMStats
+{
+	FGMMStats();
+	FGMMStats(const FVector& Reference);
+
+	/** Add a weighted point */
+	void Add(double Weight, const FVector& Point);
+
+	/** Add a weighted distribution, same as adding points with that mean and covariance */
+	void Add(double Weight, const FVector& Mu, const FMatrix3x3& Cov);
+
+	/** Add a range of weighted points, starting at a multiple of four */
+	void Add(const FGMMPoints& Points, int32 First, int32 Num, const float* Weights);
+
+	/** Scale all sums, older points fade out this way */
+	void Scale(double Factor);
+
+	/** Move the reference point, the sums still describe the same points */
+	void Rebase(const FVector& NewReference);
+
+	/** Merge sums, moved onto this reference point if needed */
+	FGMMStats& operator+=(const FGMMStats& Other);
+
+	/** Weighted mean */
+	FVector GetMu() const;
+
+	/** Weighted covariance around the mean */
+	FMatrix3x3 GetCov() const;
+
+	/** Point the sums are relative to */
+	FVector Reference;
+
+	/** Sum of weights */
+	double Weight;
+
+	/** Weighted sum of offsets */
+	double SumX, SumY, SumZ;
+
+	/** Weighted sum of offset outer products, upper triangle only */
+	double XX, XY, XZ, YY, YZ, ZZ;
+};
+
+namespace GMM
+{
+	struct FTree;
+}
+
 /**
 *
 */
@@ -41,10 +140,18 @@ struct ANGRYUTILITY_API FGMM
 
 		FGMM();
 
-	float Step();
+	/** One EM iteration, points are split over worker threads unless forced single threaded */
+	float Step(bool bForceSingleThread = false);
+
+	/** Merge distributions closer than a threshold in mean and covariance, merged ones keep the combined moments */
 	void Simplify(float Threshold);
+
+	/** Add a point and a distribution for it, or only update running statistics in online mode */
 	void AddPoint(const FVector& Point);
 
+	/** Replace distributions with clusters of the current points, seeded by k-means++ and refined by k-means */
+	void Initialize(int32 Num, int32 Iterations = 5, int32 Seed = 0);
+
 	void EM(int32 MaxIterations, float Threshold);
 
 	/** Points */
@@ -54,4 +161,49 @@ struct ANGRYUTILITY_API FGMM
 	/** Distributions */
 	UPROPERTY(EditAnywhere, BlueprintReadOnly)
 		TArray<FGMMDistribution> Distributions;
+
+	/** Approximation of Step over a kd-tree of the points, 0 evaluates every point, values of 1 and up are ignored.
+	  * Subtrees where a distribution's density stays below Tolerance of its peak are skipped for it,
+	  * subtrees where the density is within Tolerance of its middle value take cached sums instead */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = 0, ClampMax = 0.5))
+		float Tolerance;
+
+	/** Keep running statistics per distribution instead of points, AddPoint costs O(K) and memory stays bounded.
+	  * Statistics are only seeded again from Distributions when their number changes, edits in place get overwritten by the next point */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+		bool bOnline;
+
+	/** Online mode, statistics are scaled by this for every new point, 1 keeps everything */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = 0, ClampMax = 1))
+		float Forgetting;
+
+	/** Online mode, max number of distributions, closest ones get merged to make room. 0 for no limit */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = 0))
+		int32 MaxDistributions;
+
+	/** Online mode, mahalanobis distance to every distribution past which a point starts a new one */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = 0))
+		float SpawnDistance;
+
+protected:
+
+	/** Sums per distribution over all points into the first Factors.Num() entries of Stats */
+	void EStep(const TArray<FGMMFactor>& Factors, TArray<FGMMStats>& Stats, bool bForceSingleThread) const;
+
+	/** Online update for a single point */
+	void StreamPoint(const FVector& Point);
+
+	/** Set up running statistics from the current distributions */
+	void SeedRunning();
+
+	/** Merge the two distributions with the closest means, found on a grid. False if there aren't two */
+	bool MergeClosest();
+
+	/** Running statistics per distribution in online mode */
+	TArray<FGMMStats> Running;
+
+	/** Point kd-tree for Step with a tolerance, kept as long as the points don't change */
+	TSharedPtr<const GMM::FTree> Tree;
+	uint32 TreeCrc;
+	int32 TreeNum;
 };
\ No newline at end of file
@@ -0,0 +1,86 @@
+// Maintained by AngryLizard, netliz.net
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+
+/**
+* Slab allocator for spatial tree nodes.
+* Memory is bumped from big contiguous blocks and freed chunks are kept in a free list per size class,
+* so nodes of the same type get recycled without going through the system allocator.
+* Dropping the arena releases all blocks at once without visiting individual allocations.
+*/
+class ANGRYUTILITY_API FSpatialArena
+{
+public:
+	FSpatialArena(SIZE_T BlockSize = 64 * 1024);
+	~FSpatialArena();
+
+	FSpatialArena(const FSpatialArena&) = delete;
+	FSpatialArena& operator=(const FSpatialArena&) = delete;
+
+	// Get a chunk of memory, recycled from the free list if possible
+	void* Allocate(SIZE_T Size);
+
+	// Return a chunk of memory to its free list
+	void Free(void* Ptr, SIZE_T Size);
+
+	// Release all blocks, invalidates every allocation
+	void Reset();
+
+	// Guard Allocate and Free with a lock
+	void SetThreadSafe(bool bEnable);
+
+	// Bytes reserved from the system
+	SIZE_T GetReservedBytes() const;
+
+	// Bytes currently handed out
+	SIZE_T GetUsedBytes() const;
+
+	template<typename Type, typename... ArgTypes>
+	Type* New(SIZE_T Size, ArgTypes&&... Args)
+	{
+		return new(Allocate(Size)) Type(Forward<ArgTypes>(Args)...);
+	}
+
+	template<typename Type>
+	void Delete(Type* Ptr, SIZE_T Size)
+	{
+		Ptr->~Type();
+		Free(Ptr, Size);
+	}
+
+private:
+
+	// Round size up to the chunk alignment
+	static SIZE_T AlignSize(SIZE_T Size);
+
+	// Allocate a new block to bump from
+	void Grow(SIZE_T Size);
+
+	// Unguarded Allocate and Free
+	void* AllocateInternal(SIZE_T Size);
+	void FreeInternal(void* Ptr, SIZE_T Size);
+
+	// Default block size
+	SIZE_T BlockSize;
+
+	// All blocks owned by this arena
+	TArray<uint8*> Blocks;
+
+	// Bump pointers into the current block
+	uint8* Cursor;
+	uint8* End;
+
+	// Heads of intrusive free lists, indexed by aligned size
+	TArray<void*> FreeLists;
+
+	// Reserved and used bytes
+	SIZE_T ReservedBytes;
+	SIZE_T UsedBytes;
+
+	// Lock for thread-safe mode
+	FCriticalSection Mutex;
+	bool bThreadSafe;
+};
@@ -0,0 +1,118 @@
+// Maintained by AngryLizard, netliz.net
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Buddy allocator for power-of-two cubes, same Insert/Remove/ForEach interface as FSpatialRoot.
+ * Every block splits into eight octants, blocks are addressed by their morton index within their depth.
+ * Free and allocated blocks are kept as one bitmap per depth, freed octants merge back into their parent.
+ * Free bitmaps are summarized twice (one bit per non-empty word) so finding a free block costs O(depth).
+ * Boxes are rounded up to the smallest block that contains them.
+ */
+class ANGRYUTILITY_API FSpatialBuddyTree
+{
+public:
+
+	// Deepest supported depth, bitmaps of depth D hold 8^D bits
+	static constexpr int32 MaxDepth = 7;
+
+	FSpatialBuddyTree(const FVector& Location, float Size, float MinSize);
+
+	// Insert a box and return the center of the block it got
+	bool Insert(const FVector& Bounds, FVector& Result);
+
+	// Remove the block at a location, returns whether the tree is empty
+	bool Remove(const FVector& Point);
+
+	// Calls for each block returning center, extend and whether it's allocated, split blocks are branches
+	template<typename FuncType>
+	void ForEach(FuncType&& Func) const
+	{
+		ForEachBlock(0, 0, Func);
+	}
+
+	// Remove all allocations at once
+	void Reset();
+
+	// Deepest depth whose blocks contain the bounds, -1 if the bounds are bigger than the tree
+	int32 GetFitDepth(const FVector& Bounds) const;
+
+	// Edge length of blocks on a depth
+	float GetBlockSize(int32 Depth) const;
+
+	// Center of a block
+	FVector GetBlockCenter(int32 Depth, int32 Index) const;
+
+	// Number of allocated blocks
+	int32 GetNum() const;
+
+	// Number of depths below the root
+	int32 GetDepthNum() const;
+
+protected:
+
+	struct FLevel
+	{
+		// One bit per block, set if the block is free as a whole
+		TArray<uint64> Free;
+
+		// One bit per block, set if the block is handed out
+		TArray<uint64> Allocated;
+
+		// One bit per non-empty word of Free, then one bit per non-empty word of that
+		TArray<uint64> Summary[2];
+
+		// Number of set bits in Free
+		int32 FreeNum = 0;
+	};
+
+	template<typename FuncType>
+	void ForEachBlock(int32 Depth, int32 Index, FuncType& Func) const
+	{
+		const FLevel& Level = Levels[Depth];
+		if (HasBit(Level.Allocated, Index))
+		{
+			Func(GetBlockCenter(Depth, Index), FVector(GetBlockSize(Depth) / 2), true);
+		}
+		else if (!HasBit(Level.Free, Index) && Depth < Depths)
+		{
+			Func(GetBlockCenter(Depth, Index), FVector(GetBlockSize(Depth) / 2), false);
+			for (int32 Child = 0; Child < 8; Child++)
+			{
+				ForEachBlock(Depth + 1, (Index << 3) + Child, Func);
+			}
+		}
+	}
+
+	static FORCEINLINE bool HasBit(const TArray<uint64>& Words, int32 Index)
+	{
+		return((Words[Index >> 6] >> (Index & 63)) & 1);
+	}
+
+	// Index of the block containing a point
+	int32 LocateBlock(int32 Depth, const FVector& Point) const;
+
+	// Mark a block as free
+	void SetFree(int32 Depth, int32 Index);
+
+	// Clear free bits of one word and keep the summaries in sync
+	void ClearFree(int32 Depth, int32 Word, uint64 Mask);
+
+	// Take the first free block on a depth, INDEX_NONE if there is none
+	int32 TakeFree(int32 Depth);
+
+	// Bitmaps per depth, 0 is the whole volume
+	FLevel Levels[MaxDepth + 1];
+
+	// Cube corner and edge length
+	FVector Location;
+	float Size;
+
+	// Number of depths below the root
+	int32 Depths;
+
+	// Number of allocated blocks
+	int32 Num;
+};
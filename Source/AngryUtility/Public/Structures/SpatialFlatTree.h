@@ -0,0 +1,171 @@
+// Maintained by AngryLizard, netliz.net
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+enum class ESpatialNodeType : uint8
+{
+	Free,
+	Leaf,
+	Branch
+};
+
+/**
+ * Number of axes a vector type is sliced along.
+ */
+template<typename VectorType>
+struct TSpatialDimensions;
+
+template<>
+struct TSpatialDimensions<FVector>
+{
+	static constexpr int32 Num = 3;
+};
+
+template<>
+struct TSpatialDimensions<FVector2D>
+{
+	static constexpr int32 Num = 2;
+};
+
+/**
+ * Node of a flat spatial tree, leaves and branches share the same layout.
+ */
+template<typename VectorType>
+struct TSpatialFlatNode
+{
+	static constexpr int32 Dimensions = TSpatialDimensions<VectorType>::Num;
+
+	// Cell bounds
+	VectorType Location;
+	VectorType Size;
+
+	// Biggest available space
+	VectorType Space;
+
+	// First child slot for branches, next free node for free nodes
+	int32 Children;
+
+	// Number of children
+	int32 Num;
+
+	// Split axis as component index
+	uint8 Axis;
+
+	// Node tag
+	ESpatialNodeType Type;
+
+	// Check whether point is inside this cell
+	FORCEINLINE bool IsInside(const VectorType& Point) const
+	{
+		for (int32 Index = 0; Index < Dimensions; Index++)
+		{
+			if (Point[Index] < Location[Index] || Location[Index] + Size[Index] <= Point[Index])
+			{
+				return(false);
+			}
+		}
+		return(true);
+	}
+
+	// Check whether bounds have room in this cell
+	FORCEINLINE bool HasSpace(const VectorType& Bounds) const
+	{
+		for (int32 Index = 0; Index < Dimensions; Index++)
+		{
+			if (Space[Index] <= Bounds[Index])
+			{
+				return(false);
+			}
+		}
+		return(true);
+	}
+};
+
+/**
+ * Same placement as FSpatialRoot, but all nodes live in one contiguous array and are addressed by index.
+ * Nodes are tagged instead of virtual, child slots of a branch are stored next to each other.
+ * Templated on the vector type, axes are cycled from the last component down to the first.
+ * Members are defined in the translation unit, which instantiates FVector and FVector2D.
+ */
+template<typename VectorType>
+class ANGRYUTILITY_API TSpatialFlatTree
+{
+public:
+	using FNode = TSpatialFlatNode<VectorType>;
+	static constexpr int32 Dimensions = TSpatialDimensions<VectorType>::Num;
+
+	TSpatialFlatTree(const VectorType& Location, const VectorType& Size, int32 Slices);
+
+	// Insert a box and return its center
+	bool Insert(const VectorType& Bounds, VectorType& Result);
+
+	// Remove the leaf at a location, returns whether the tree is empty
+	bool Remove(const VectorType& Point);
+
+	// Calls for each node returning center, extend and whether it's a leaf.
+	// Nodes are visited in memory order, parents are not guaranteed to come before their children.
+	template<typename FuncType>
+	void ForEach(FuncType&& Func) const
+	{
+		for (const FNode& Node : Nodes)
+		{
+			if (Node.Type != ESpatialNodeType::Free)
+			{
+				const VectorType Extend = Node.Size / 2;
+				const VectorType Center = Node.Location + Extend;
+				Func(Center, Extend, Node.Type == ESpatialNodeType::Leaf);
+			}
+		}
+	}
+
+	// Remove all allocations at once
+	void Reset();
+
+	// Number of live nodes
+	int32 GetNodeNum() const;
+
+	// Index of the top level branch
+	static constexpr int32 RootIndex = 0;
+
+protected:
+
+	// Get next axis
+	static uint8 GetNext(uint8 Axis);
+
+	// Slice size
+	VectorType SliceSize(const VectorType& Size, uint8 Axis) const;
+
+	// Set max available space from children
+	void UpdateSpace(int32 Index);
+
+	// Allocate a node, recycled from the free list if possible
+	int32 AllocateNode(const VectorType& Location, const VectorType& Size, uint8 Axis, ESpatialNodeType Type);
+
+	// Return a node and its child slots to the free lists
+	void FreeNode(int32 Index);
+
+	// All nodes, index 0 is the root
+	TArray<FNode> Nodes;
+
+	// Child slots, Slices consecutive entries per branch
+	TArray<int32> Links;
+
+	// Free list heads
+	int32 FreeNodes;
+	int32 FreeLinks;
+
+	// Number of live nodes
+	int32 NodeNum;
+
+	// Max number of children
+	int32 Slices;
+};
+
+using FSpatialFlatNode = TSpatialFlatNode<FVector>;
+using FSpatialFlatTree = TSpatialFlatTree<FVector>;
+
+// Packs 2D regions such as texture atlas entries
+using FSpatialAtlasNode = TSpatialFlatNode<FVector2D>;
+using FSpatialAtlasTree = TSpatialFlatTree<FVector2D>;
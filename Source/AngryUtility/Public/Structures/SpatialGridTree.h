@@ -0,0 +1,139 @@
+// Maintained by AngryLizard, netliz.net
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Structures/SpatialFlatTree.h"
+
+/**
+ * Child slots of a grid branch, stored per axis so all slots are tested with a few vector compares.
+ */
+struct FSpatialGridLanes
+{
+	// Max number of children, two vector registers per axis
+	static constexpr int32 MaxSlices = 8;
+
+	// Biggest available space of each slot per axis.
+	// Empty slots hold their full size, leaves and unused lanes hold zero.
+	int32 Space[3][MaxSlices];
+
+	// Node of each slot, INDEX_NONE if empty. First entry is the next free block for free blocks.
+	int32 Children[MaxSlices];
+
+	// One bit per slot that has a child
+	uint32 Occupied;
+};
+
+/**
+ * Node of a grid tree, all coordinates are whole cells.
+ */
+struct FSpatialGridNode
+{
+	// Cell bounds
+	FIntVector Location;
+	FIntVector Size;
+
+	// Lane block for branches, next free node for free nodes
+	int32 Lanes;
+
+	// Number of children
+	int32 Num;
+
+	// Split axis as component index
+	uint8 Axis;
+
+	// Node tag
+	ESpatialNodeType Type;
+};
+
+/**
+ * Same placement as FSpatialFlatTree, but on an integer grid of cells.
+ * Slots are cut at Size * Slot / Slices, so sizes don't have to be divisible and slicing never drifts.
+ * Free space of the children is kept per axis across slots, which makes picking a child a handful of vector ops.
+ */
+class ANGRYUTILITY_API FSpatialGridTree
+{
+public:
+
+	FSpatialGridTree(const FIntVector& Location, const FIntVector& Size, int32 Slices);
+
+	// Insert a box of whole cells and return the first cell it got
+	bool Insert(const FIntVector& Bounds, FIntVector& Result);
+
+	// Remove the leaf containing a cell, returns whether the tree is empty
+	bool Remove(const FIntVector& Cell);
+
+	// Calls for each node returning location, size and whether it's a leaf.
+	// Nodes are visited in memory order, parents are not guaranteed to come before their children.
+	template<typename FuncType>
+	void ForEach(FuncType&& Func) const
+	{
+		for (const FSpatialGridNode& Node : Nodes)
+		{
+			if (Node.Type != ESpatialNodeType::Free)
+			{
+				Func(Node.Location, Node.Size, Node.Type == ESpatialNodeType::Leaf);
+			}
+		}
+	}
+
+	// Remove all allocations at once
+	void Reset();
+
+	// Number of live nodes
+	int32 GetNodeNum() const;
+
+	// Index of the top level branch
+	static constexpr int32 RootIndex = 0;
+
+protected:
+
+	// Get next axis
+	static uint8 GetNext(uint8 Axis);
+
+	// Start of a slot along a branch of given length
+	int32 GetSlotOffset(int32 Length, int32 Slot) const;
+
+	// Slot containing an offset along a branch of given length
+	int32 GetSlotAt(int32 Length, int32 Offset) const;
+
+	// Size of a slot of a branch
+	FIntVector GetSlotSize(const FSpatialGridNode& Node, int32 Slot) const;
+
+	// One bit per slot with room for the bounds
+	uint32 GetFitMask(const FSpatialGridLanes& Block, const FIntVector& Bounds) const;
+
+	// Biggest available space over all slots
+	FIntVector GetSpace(const FSpatialGridLanes& Block) const;
+
+	// Set the space of a slot, returns whether it changed
+	static bool SetSlotSpace(FSpatialGridLanes& Block, int32 Slot, const FIntVector& Space);
+
+	// Allocate a node, recycled from the free list if possible
+	int32 AllocateNode(const FIntVector& Location, const FIntVector& Size, uint8 Axis, ESpatialNodeType Type);
+
+	// Return a node and its lane block to the free lists
+	void FreeNode(int32 Index);
+
+	// All nodes, index 0 is the root
+	TArray<FSpatialGridNode> Nodes;
+
+	// Lane blocks, one per branch
+	TArray<FSpatialGridLanes> Lanes;
+
+	// Free list heads
+	int32 FreeNodes;
+	int32 FreeLanes;
+
+	// Number of live nodes
+	int32 NodeNum;
+
+	// Max number of children
+	int32 Slices;
+
+	// Number of lanes worth testing, a multiple of four
+	int32 LaneNum;
+
+	// One bit per used slot
+	uint32 SlotMask;
+};
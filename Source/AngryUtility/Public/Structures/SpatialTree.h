@@ -3,10 +3,189 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Structures/SpatialArena.h"
+#include "HAL/CriticalSection.h"
 #include <functional>
+#include <atomic>
+
+class FSpatialRoot;
+class FSpatialBranch;
+
+/**
+ * How inserts pick among cells that have room.
+ */
+enum class ESpatialPlacement : uint8
+{
+	// Take the first child with room, empty slots last
+	FirstFit,
+
+	// Take the smallest free cell that still fits
+	BestFit
+};
+
+/**
+ * Axis permutation of a box, names list which input component ends up on X, Y and Z.
+ */
+enum class ESpatialOrientation : uint8
+{
+	XYZ,
+	XZY,
+	YXZ,
+	YZX,
+	ZXY,
+	ZYX,
+	Num
+};
+
+/**
+ * Compact reference to an allocation, stores the child slot taken on every level packed from the top down.
+ * Handles stay valid until their allocation is removed.
+ */
+struct ANGRYUTILITY_API FSpatialHandle
+{
+	// Slot indices, top level in the lowest bits
+	uint64 Path = 0;
+
+	// Number of stored levels
+	uint8 Depth = 0;
+
+	// How often the root had grown when this handle was made, the path lacks the levels added since
+	uint8 Growth = 0;
+
+	// Whether this handle points to an allocation
+	bool IsValid() const;
+
+	// Append slot for the next level, invalidates the handle if the path doesn't fit
+	void Push(int32 Slot, int32 Bits);
+
+	// Slot on a given level
+	int32 GetSlot(int32 Level, int32 Bits) const;
+
+	// Prepend levels that took the first slot, invalidates the handle if the path doesn't fit
+	void Lift(int32 Levels, int32 Bits);
+
+	// Depth marking a path that was too deep to be stored
+	static constexpr uint8 Overflow = MAX_uint8;
+};
 
 /**
- * 
+ * Allocation that was visited by compaction, it may have stayed in place.
+ */
+struct ANGRYUTILITY_API FSpatialRemap
+{
+	FVector From;
+	FVector To;
+
+	// Handle for the new cell, handles from before compaction are stale
+	FSpatialHandle Handle;
+};
+
+/**
+ * Progress of an incremental compaction, allocations still to be moved.
+ */
+struct ANGRYUTILITY_API FSpatialCompaction
+{
+	// Leaf centers, next one last
+	TArray<FVector> Pending;
+
+	// Whether leaves have been collected yet
+	bool bStarted = false;
+
+	// Whether every collected leaf has been visited
+	bool IsDone() const { return bStarted && Pending.Num() == 0; }
+};
+
+/**
+ * Utilization and fragmentation of a tree, see FSpatialRoot::GetStats.
+ */
+struct ANGRYUTILITY_API FSpatialStats
+{
+	// Live nodes by type, the root branch included
+	int32 LeafNum = 0;
+	int32 BranchNum = 0;
+
+	// Live nodes per depth up to the deepest used one, the root is depth 0
+	TArray<int32, TInlineAllocator<16>> LeafDepths;
+	TArray<int32, TInlineAllocator<16>> BranchDepths;
+
+	// Arena memory in use
+	SIZE_T Bytes = 0;
+
+	// Volume of occupied leaf cells and the rest of the tree
+	double OccupiedVolume = 0.0;
+	double FreeVolume = 0.0;
+
+	// Biggest free cell extent, boxes need to be smaller in every component to fit
+	FVector LargestFree = FVector::ZeroVector;
+
+	// Inserts that found no room since construction or the last Reset
+	int32 FailedInserts = 0;
+};
+
+/**
+ * Occupied cells added and removed since the last drain, see FSpatialRoot::DrainChanges.
+ * Apply removals before additions. Cells added and removed again in between are left out.
+ */
+struct ANGRYUTILITY_API FSpatialChanges
+{
+	// Leaf cells that appeared
+	TArray<FVector> AddedCenters;
+	TArray<FVector> AddedExtends;
+
+	// Leaf cells that are gone
+	TArray<FVector> RemovedCenters;
+	TArray<FVector> RemovedExtends;
+
+	// Every leaf from before is gone, the tree was reset or loaded
+	bool bCleared = false;
+};
+
+/**
+ * Size class with branches reserved for it, see FSpatialRoot::AddSlab.
+ */
+struct ANGRYUTILITY_API FSpatialSlab
+{
+	// Exact bounds served by this slab
+	FVector Bounds = FVector::ZeroVector;
+
+	// Reservation index times slices plus slot, next one last. Entries taken by regular inserts in the meantime are skipped.
+	TArray<int32> FreeSlots;
+};
+
+/**
+ * Branch reserved for a slab.
+ */
+struct ANGRYUTILITY_API FSpatialReservation
+{
+	FSpatialBranch* Branch = nullptr;
+
+	// Path to the branch, lifted when used after the root grew
+	FSpatialHandle Path;
+
+	// Owning slab
+	int32 Slab = INDEX_NONE;
+};
+
+/**
+ * Boxes of a batch that end up in cells of the same size and can therefore be placed interchangeably.
+ */
+struct ANGRYUTILITY_API FSpatialBatchGroup
+{
+	// Component-wise max of all boxes in this group
+	FVector Bounds = FVector::ZeroVector;
+
+	// Indices into the batch, biggest first
+	TArray<int32> Items;
+
+	// Number of items already placed
+	int32 Placed = 0;
+
+	// Whether all items have been placed
+	bool IsDone() const { return Placed == Items.Num(); }
+};
+
+/**
+ *
  */
 class ANGRYUTILITY_API FSpatialTree
 {
@@ -19,10 +198,41 @@ protected:
 	// Biggest available space
 	FVector Space;
 
+	// Guards this node in concurrent mode
+	std::atomic<bool> bLocked;
+
+	// Unlinked from the tree in concurrent mode, waiting to be released
+	bool bRetired;
+
+	// Speculation this node was created in, nodes from older ones are copied before they change
+	uint32 Epoch;
+
 public:
 	FSpatialTree(const FVector& Location, const FVector& Size);
 	virtual ~FSpatialTree();
 
+	// Spin lock for concurrent mode, always lock parents before children
+	void Lock();
+	void Unlock();
+
+	// Flag as unlinked, needs to be locked
+	void MarkRetired();
+
+	// Speculation this node was created in
+	uint32 GetEpoch() const;
+	void SetEpoch(uint32 NewEpoch);
+
+	// Whether this is an occupied cell
+	virtual bool IsLeaf() const = 0;
+
+	// Cell bounds
+	const FVector& GetLocation() const;
+	const FVector& GetSize() const;
+	FBox GetBox() const;
+
+	// Biggest available space in this tree
+	const FVector& GetSpace() const;
+
 	// Check whether bounds have room in this tree
 	bool IsInside(const FVector& Point) const;
 
@@ -33,14 +243,26 @@ public:
 	FVector GetMax(const FVector& Reference) const;
 
 
-	// Insert a box into this cell or one of its children
-	virtual bool Insert(const FVector& Bounds, FVector& Result) = 0;
+	// Insert a box into this cell or one of its children, appends taken slots to Handle
+	virtual bool Insert(FSpatialRoot& Root, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle) = 0;
+
+	// Insert while other threads access the tree, entered locked and returns unlocked
+	virtual bool InsertConcurrent(FSpatialRoot& Root, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle) = 0;
+
+	// Insert as many pending boxes as possible, exhausted groups are removed from Pending
+	virtual void InsertBatch(FSpatialRoot& Root, TArray<FSpatialBatchGroup*>& Pending, TArray<FVector>& OutLocations) = 0;
 
 	// Remove a leaf at a location
-	virtual bool Remove(const FVector& Point) = 0;
+	virtual bool Remove(FSpatialRoot& Root, const FVector& Point) = 0;
+
+	// Remove a leaf following a handle, Level is the depth of this node
+	virtual bool Remove(FSpatialRoot& Root, const FSpatialHandle& Handle, int32 Level) = 0;
 
 	// Calls for each child returning center, extend and whether it's a leaf
 	virtual void ForEach(std::function<void(const FVector&, const FVector&, bool)> Func) = 0;
+
+	// Give this node's memory back to the root
+	virtual void Release(FSpatialRoot& Root) = 0;
 };
 
 class ANGRYUTILITY_API FSpatialLeaf : public FSpatialTree
@@ -48,18 +270,34 @@ class ANGRYUTILITY_API FSpatialLeaf : public FSpatialTree
 public:
 	FSpatialLeaf(const FVector& Location, const FVector& Size);
 	virtual ~FSpatialLeaf();
-	
-	virtual bool Insert(const FVector& Bounds, FVector& Result) override;
-	virtual bool Remove(const FVector& Point) override;
+
+	// Allocate a leaf from the root's arena
+	static FSpatialLeaf* Create(FSpatialRoot& Root, const FVector& Location, const FVector& Size);
+
+	virtual bool IsLeaf() const override;
+	virtual bool Insert(FSpatialRoot& Root, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle) override;
+	virtual bool InsertConcurrent(FSpatialRoot& Root, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle) override;
+	virtual void InsertBatch(FSpatialRoot& Root, TArray<FSpatialBatchGroup*>& Pending, TArray<FVector>& OutLocations) override;
+	virtual bool Remove(FSpatialRoot& Root, const FVector& Point) override;
+	virtual bool Remove(FSpatialRoot& Root, const FSpatialHandle& Handle, int32 Level) override;
 	virtual void ForEach(std::function<void(const FVector&, const FVector&, bool)> Func) override;
+	virtual void Release(FSpatialRoot& Root) override;
 };
 
 class ANGRYUTILITY_API FSpatialBranch : public FSpatialTree
 {
+public:
+
+	// Depths beyond this aren't tracked for best-fit
+	static constexpr int32 MaxDepth = 64;
+
+	// Most children a branch can have, keeps branch allocations and handle paths within reason
+	static constexpr int32 MaxSlices = 1024;
+
 protected:
 
-	// Children
-	TArray<FSpatialTree*> Children;
+	// Children, stored right behind the branch in the same allocation
+	FSpatialTree** Children;
 
 	// Number of children
 	int32 Num;
@@ -70,32 +308,370 @@ protected:
 	// Split axis
 	EAxis::Type Axis;
 
+	// Distance from the top level branch
+	int32 Depth;
+
+	// Bit per depth at which this subtree still has an empty slot.
+	// All cells on one depth have the same size, so this tells exactly which free cell sizes are available.
+	uint64 FreeDepths;
+
+	// Index into the root's slab reservations, reserved branches stay alive when empty
+	int32 Reservation;
+
+	// Recompute Space and FreeDepths, optionally locking children while reading them
+	void GatherSpace(bool bLockChildren);
+
 public:
-	FSpatialBranch(const FVector& Location, const FVector& Size, EAxis::Type Axis, int32 Slices);
+	FSpatialBranch(const FVector& Location, const FVector& Size, EAxis::Type Axis, int32 Slices, int32 Depth);
 	virtual ~FSpatialBranch();
-	
+
+	// Allocate a branch together with its children from the root's arena
+	static FSpatialBranch* Create(FSpatialRoot& Root, const FVector& Location, const FVector& Size, EAxis::Type Axis, int32 Slices, int32 Depth);
+
+	// Memory needed for a branch with its children
+	static SIZE_T GetAllocSize(int32 Slices);
+
+	// Children view
+	TArrayView<FSpatialTree*> GetChildren() const;
+
+	// Number of children
+	int32 GetNum() const;
+
+	// Split axis
+	EAxis::Type GetAxis() const;
+
+	// Distance from the top level branch
+	int32 GetDepth() const;
+
+	// Depths with empty slots in this subtree
+	uint64 GetFreeDepths() const;
+
 	// Get next axis
 	EAxis::Type GetNext() const;
+	static EAxis::Type GetNext(EAxis::Type Axis);
 
 	// Slice size
-	FVector SliceSize();
+	FVector SliceSize() const;
+	static FVector SliceSize(const FVector& Size, EAxis::Type Axis, int32 Slices);
 
 	// Set max available space from children
 	void UpdateSpace();
 
-	// Inserts and updates 
-	bool Insert(FSpatialTree* Child, const FVector& Bounds, FVector& Result);
+	// Same as UpdateSpace but locks every child while reading it
+	void UpdateSpaceConcurrent();
+
+	// Cell bounds of a child slot
+	void GetSlotCell(int32 Slot, FVector& OutLocation, FVector& OutSize) const;
+
+	// Move this subtree one level down, after the root grew on top of it
+	void Deepen();
+
+	// Link an existing subtree into an empty slot, its cell has to match the slot
+	void Adopt(int32 Slot, FSpatialTree* Child);
+
+	// Create an empty branch on BranchDepth in the first free slot that can hold it, appends taken slots to Handle
+	FSpatialBranch* InsertBranchAtDepth(FSpatialRoot& Root, int32 BranchDepth, FSpatialHandle& Handle);
+
+	// Recompute space along the path to a point, bottom up
+	void UpdateSpaceAt(const FVector& Point);
 
-	virtual bool Insert(const FVector& Bounds, FVector& Result) override;
-	virtual bool Remove(const FVector& Point) override;
+	// Copy this branch into a new allocation sharing the same children
+	FSpatialBranch* Clone(FSpatialRoot& Root) const;
+
+	// Slab reservation this branch belongs to, INDEX_NONE if it's a regular branch
+	int32 GetReservation() const;
+	void SetReservation(int32 NewReservation);
+
+	// Creates a branch or leaf in an empty slot, depending on whether bounds fit into a further split
+	FSpatialTree* CreateChild(FSpatialRoot& Root, int32 Slot, const FVector& Bounds, bool& bIsLeaf);
+	FSpatialTree* CreateChild(FSpatialRoot& Root, int32 Slot, bool bIsLeaf);
+
+	// Inserts and updates
+	bool Insert(FSpatialRoot& Root, int32 Slot, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle);
+
+	// Insert a leaf into the first free slot of a branch on LeafDepth
+	bool InsertAtDepth(FSpatialRoot& Root, int32 LeafDepth, FVector& Result, FSpatialHandle& Handle);
+
+	// Insert into the subtree holding the smallest free cell that fits, FitDepth is the deepest level whose cells fit
+	bool InsertBestFit(FSpatialRoot& Root, const FVector& Bounds, int32 FitDepth, FVector& Result, FSpatialHandle& Handle);
+
+	// Remove while other threads access the tree, entered locked and returns unlocked. Returns whether this branch is empty.
+	bool RemoveConcurrent(FSpatialRoot& Root, const FVector& Point);
+
+	virtual bool IsLeaf() const override;
+	virtual bool Insert(FSpatialRoot& Root, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle) override;
+	virtual bool InsertConcurrent(FSpatialRoot& Root, const FVector& Bounds, FVector& Result, FSpatialHandle& Handle) override;
+	virtual void InsertBatch(FSpatialRoot& Root, TArray<FSpatialBatchGroup*>& Pending, TArray<FVector>& OutLocations) override;
+	virtual bool Remove(FSpatialRoot& Root, const FVector& Point) override;
+	virtual bool Remove(FSpatialRoot& Root, const FSpatialHandle& Handle, int32 Level) override;
 	virtual void ForEach(std::function<void(const FVector&, const FVector&, bool)> Func) override;
+	virtual void Release(FSpatialRoot& Root) override;
+};
+
+/**
+ * Changes made since a speculation began, see FSpatialRoot::BeginSpeculation.
+ */
+struct ANGRYUTILITY_API FSpatialSpeculation
+{
+	// Top level branch when the speculation began
+	FSpatialBranch* Tree = nullptr;
+
+	// Nodes of older speculations are copied before they change
+	uint32 Epoch = 0;
+
+	// Nodes allocated during this speculation, released on discard
+	TArray<FSpatialTree*> Created;
+
+	// Nodes unlinked during this speculation, released on commit
+	TArray<FSpatialTree*> Garbage;
+
+	// Node counters when the speculation began
+	int32 LeafDepths[FSpatialBranch::MaxDepth + 1];
+	int32 BranchDepths[FSpatialBranch::MaxDepth + 1];
 };
 
-class ANGRYUTILITY_API FSpatialRoot : public FSpatialBranch
+/**
+ * Owns a spatial tree and the arena all of its nodes are allocated from.
+ * Nodes are never freed one by one on destruction, dropping the root drops the whole arena.
+ * In concurrent mode nodes are locked hand-over-hand from the top down and removed nodes are only released once concurrent mode ends.
+ */
+class ANGRYUTILITY_API FSpatialRoot
 {
+	friend class FSpatialLeaf;
+	friend class FSpatialBranch;
+
+protected:
+
+	// Node memory, needs to outlive the tree
+	FSpatialArena Arena;
+
+	// Top level branch
+	FSpatialBranch* Tree;
+
+	// Bits per level in handle paths
+	int32 PathBits;
+
+	// Size of the cells in the slots of a branch on each depth
+	FVector CellSizes[FSpatialBranch::MaxDepth];
+
+	// Compute cell sizes from the top level branch
+	void UpdateCellSizes();
+
+	// Whether Insert and Remove may be called from several threads at once
+	bool bConcurrent;
+
+	// Placement strategy for single inserts
+	ESpatialPlacement Placement;
+
+	// Whether single inserts may permute the axes of their bounds
+	bool bRotate;
+
+	// Insert bounds as given without touching the failed insert counter
+	bool InsertOriented(const FVector& Bounds, FVector& Result, FSpatialHandle& OutHandle);
+
+	// Insert in the given or, if rotation is enabled, the best fitting orientation
+	bool InsertRotated(const FVector& Bounds, FVector& Result, FSpatialHandle& OutHandle, ESpatialOrientation& OutOrientation);
+
+	// Whether inserts that find no room grow the root, and up to which size
+	bool bGrowable;
+	FVector MaxSize;
+
+	// Number of times the root grew since the last Reset, kept by Save and Load so older handles still get lifted
+	int32 Growth;
+
+	// Open speculations, innermost last
+	TArray<FSpatialSpeculation> Speculations;
+	uint32 NextEpoch;
+
+	// Make a node writable in the current speculation, branches from older ones are replaced by a copy
+	FSpatialTree* Touch(FSpatialTree* Node);
+
+	// Keep track of a new node for the current speculation
+	void Track(FSpatialTree* Node);
+
+	// Release an unlinked node, or keep it until the current speculation is committed
+	void Drop(FSpatialTree* Node);
+
+	// Size classes and the branches reserved for them
+	TArray<FSpatialSlab> Slabs;
+	TArray<FSpatialReservation> Reservations;
+
+	// Place into a slot of a branch reserved for a slab, reserves a new branch if all are full
+	bool InsertSlab(int32 Slab, FVector& Result, FSpatialHandle& OutHandle);
+
+	// Put a leaf into an empty slot of a reserved branch
+	void TakeSlabSlot(int32 Reservation, int32 Slot, FVector& Result, FSpatialHandle& OutHandle);
+
+	// Called by reserved branches when one of their slots empties
+	void FreeSlabSlot(int32 Reservation, int32 Slot);
+
+	// Drop reserved branches from all slabs, the size classes stay
+	void ResetSlabs();
+
+	// Rebuild free slot lists from the reserved branches
+	void RebuildSlabs();
+
+	// Wrap the root in a new parent holding it in the first slot, so every existing cell keeps its bounds.
+	// Returns false if the new root would exceed MaxSize or the tree would get too deep.
+	bool Grow();
+
+	// Nodes unlinked in concurrent mode, other threads might still be on their way through them
+	FCriticalSection RetiredMutex;
+	TArray<FSpatialTree*> Retired;
+
+	// Keep node alive until concurrent mode ends
+	void Retire(FSpatialTree* Node);
+
+	// Release all retired nodes
+	void Flush();
+
+	// Live nodes per depth and failed inserts, kept up to date so stats are cheap to poll
+	std::atomic<int32> LeafDepths[FSpatialBranch::MaxDepth + 1];
+	std::atomic<int32> BranchDepths[FSpatialBranch::MaxDepth + 1];
+	std::atomic<int32> FailedInserts;
+
+	// Track a node being created or released on a depth
+	void CountNode(const FSpatialTree* Node, int32 Depth, int32 Delta);
+
+	// Whether leaf changes are recorded
+	bool bJournal;
+
+	// Changes since the last drain, and where not yet drained additions are by center
+	FCriticalSection JournalMutex;
+	FSpatialChanges Changes;
+	TMap<FVector, int32> PendingAdded;
+
+	// Record a leaf appearing or disappearing, locks in concurrent mode
+	void RecordChange(const FSpatialTree* Leaf, bool bAdded);
+	void RecordChangeInternal(const FSpatialTree* Leaf, bool bAdded);
+
+	// Forget recorded changes, every leaf from before is gone
+	void ClearChanges();
+
+	// Start counting over with only the root branch
+	void ResetCounters();
+
 public:
 	FSpatialRoot(const FVector& Location, const FVector& Size, int32 Slices);
-	virtual ~FSpatialRoot();
+	~FSpatialRoot();
+
+	FSpatialRoot(const FSpatialRoot&) = delete;
+	FSpatialRoot& operator=(const FSpatialRoot&) = delete;
+
+	// Insert a box and return its center
+	bool Insert(const FVector& Bounds, FVector& Result);
+
+	// Insert a box and return its center and a handle for removal
+	bool Insert(const FVector& Bounds, FVector& Result, FSpatialHandle& OutHandle);
+
+	// Insert a box and return its center, a handle for removal and the orientation it was placed in
+	bool Insert(const FVector& Bounds, FVector& Result, FSpatialHandle& OutHandle, ESpatialOrientation& OutOrientation);
+
+	// Insert many boxes at once, biggest first. Locations are returned in input order,
+	// OutPlaced flags which boxes found room. Returns number of placed boxes.
+	int32 InsertBatch(TArrayView<const FVector> Bounds, TArray<FVector>& OutLocations, TBitArray<>* OutPlaced = nullptr);
+
+	// Remove the leaf at a location, returns whether the tree is empty
+	bool Remove(const FVector& Point);
+
+	// Remove the leaf a handle points to without searching, returns whether the tree is empty
+	bool Remove(const FSpatialHandle& Handle);
+
+	// Calls for each node returning center, extend and whether it's a leaf
+	void ForEach(std::function<void(const FVector&, const FVector&, bool)> Func);
 
-	virtual bool Insert(const FVector& Bounds, FVector& Result) override;
-};
\ No newline at end of file
+	// Move allocations into the first free cell of their size, biggest first, so free space gathers at the end.
+	// Every allocation gets a new handle, OutRemap lists old and new location with the new handle in the order they were visited.
+	void Compact(TArray<FSpatialRemap>& OutRemap);
+
+	// Same as Compact but stops once TimeBudget seconds are used up, call again with the same State until it returns true.
+	// The tree can be changed in between, allocations that are gone by then are skipped.
+	bool Compact(FSpatialCompaction& State, double TimeBudget, TArray<FSpatialRemap>& OutRemap);
+
+	// Collect cells of all occupied leaves overlapping a box or sphere, subtrees outside are skipped
+	void QueryBox(const FBox& Box, TArray<FBox>& OutLeaves) const;
+	void QuerySphere(const FSphere& Sphere, TArray<FBox>& OutLeaves) const;
+
+	// Whether a point lies inside an occupied leaf
+	bool IsOccupied(const FVector& Point) const;
+
+	// Find the empty cell closest to a point that has room for bounds
+	bool FindNearestFree(const FVector& Bounds, const FVector& Point, FBox& OutCell) const;
+
+	// Remove all allocations at once
+	void Reset();
+
+	// Write the tree layout into a compact binary snapshot, bounds are stored as doubles regardless of the vector type
+	void Save(TArray<uint8>& OutData) const;
+
+	// Rebuild the tree from a snapshot without running any placement, bounds and slices are taken from the snapshot.
+	// Returns false and leaves the tree empty if the data is invalid.
+	bool Load(TArrayView<const uint8> Data);
+
+	// Start a speculative branch of the tree. Insert and Remove copy the nodes on their path and share everything else
+	// with the state before, so committing or discarding costs O(changed nodes). Speculations can be nested.
+	// Batch inserts, compaction, slabs, growth, Reset, Load and concurrent mode aren't available while speculating.
+	void BeginSpeculation();
+
+	// Keep the changes of the innermost speculation
+	void CommitSpeculation();
+
+	// Drop the changes of the innermost speculation and return to the state it began with
+	void DiscardSpeculation();
+
+	// Whether any speculation is open
+	bool IsSpeculating() const;
+
+	// Allow Insert and Remove by point to be called from several threads at once.
+	// Other operations still need exclusive access. Not thread-safe itself.
+	void SetConcurrent(bool bEnable);
+	bool IsConcurrent() const;
+
+	// Placement strategy for Insert, concurrent and batch inserts always use first-fit
+	void SetPlacement(ESpatialPlacement NewPlacement);
+	ESpatialPlacement GetPlacement() const;
+
+	// Let Insert try every axis permutation of a box and take the one ending up in the smallest cell.
+	// Batch inserts always keep the given orientation.
+	void SetRotate(bool bEnable);
+	bool CanRotate() const;
+
+	// Permute the axes of bounds
+	static FVector Orient(const FVector& Bounds, ESpatialOrientation Orientation);
+
+	// Let single inserts that find no room grow the root volume up to MaxSize. The root is wrapped in a new parent
+	// that is Slices times as big along one axis, axes take turns. Existing locations and handles stay valid.
+	// This doesn't double the whole extent at once: a new level can only slice one axis, so with two slices
+	// it takes three growths to double every axis. Concurrent and batch inserts never grow.
+	void SetGrowable(bool bEnable, const FVector& NewMaxSize);
+	bool IsGrowable() const;
+
+	// Reserve branches for boxes of exactly these bounds. Insert hands out their slots from a free list instead of searching,
+	// other sizes keep using regular placement. Reserved branches stay alive while empty until Reset or Load,
+	// snapshots don't store reservations and leave out the empty ones.
+	// Fails for bounds that only fit the top level. Slabs are skipped in concurrent mode.
+	bool AddSlab(const FVector& Bounds);
+
+	// Deepest level with a free cell that has room for bounds, INDEX_NONE if even the top level is too small
+	int32 GetFitDepth(const FVector& Bounds) const;
+
+	// Record which leaves are added and removed, so consumers can update their buffers without walking the whole tree.
+	// Start from a ForEach walk when enabling. Speculative changes are recorded once committed.
+	void SetJournal(bool bEnable);
+	bool HasJournal() const;
+
+	// Move recorded changes out and start recording anew
+	void DrainChanges(FSpatialChanges& OutChanges);
+
+	// Gather utilization counters, cheap enough to call every frame
+	void GetStats(FSpatialStats& OutStats) const;
+
+	// Set the SpatialTree stat group from GetStats, trees publishing in the same frame overwrite each other
+	void PublishStats() const;
+
+	// Top level branch
+	const FSpatialBranch* GetTree() const;
+
+	// Node memory
+	const FSpatialArena& GetArena() const;
+};